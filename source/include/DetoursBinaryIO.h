@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// Bounds checked reader for the binary cache files, any read past the end fails.
+struct DetoursBinaryReader
+{
+    const uint8_t* cursor;
+    const uint8_t* end;
+
+    bool Read(void* out, size_t size)
+    {
+        if (size_t(end - cursor) < size) return false;
+        memcpy(out, cursor, size);
+        cursor += size;
+        return true;
+    }
+    template<class T>
+    bool Read(T& value)
+    {
+        return Read(&value, sizeof(T));
+    }
+    bool Read(std::wstring& str)
+    {
+        uint32_t length;
+        if (!Read(length) || size_t(end - cursor) / sizeof(wchar_t) < length) return false;
+        str.assign((const wchar_t*)cursor, length);
+        cursor += length * sizeof(wchar_t);
+        return true;
+    }
+};
+
+struct DetoursBinaryWriter
+{
+    std::vector<uint8_t> buffer;
+
+    void Write(const void* data, size_t size)
+    {
+        buffer.insert(buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+    }
+    template<class T>
+    void Write(const T& value)
+    {
+        Write(&value, sizeof(T));
+    }
+    void Write(const std::wstring& str)
+    {
+        Write(uint32_t(str.size()));
+        Write(str.data(), str.size() * sizeof(wchar_t));
+    }
+};
+
+/// Write to a temporary file first then move it, so that we never leave a partially written file behind.
+bool DetoursWriteFileAtomically(const std::wstring& path, const std::vector<uint8_t>& content);
@@ -0,0 +1,21 @@
+#pragma once
+
+// DETOURS_X86_SIMD tells whether SSE2 and AVX2 intrinsics can be used, with DETOURS_TARGET_AVX2 on the functions using
+// AVX2. Those functions must only be called if DetoursCpuSupportsAVX2() returns true.
+// The tests define DETOURS_X86_SIMD to 0 to build the portable code, and DETOURS_DISABLE_AVX2 to use the SSE2 code.
+#if !defined(DETOURS_X86_SIMD) && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+#define DETOURS_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets us use any intrinsic as long as we check the CPU support at runtime.
+#define DETOURS_TARGET_AVX2
+#else
+#define DETOURS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif !defined(DETOURS_X86_SIMD)
+#define DETOURS_X86_SIMD 0
+#endif
+
+/// Checked once, both the CPU and the OS must support AVX2.
+bool DetoursCpuSupportsAVX2();
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Fixed capacity pointer to pointer map, using open addressing with linear probing.
+/// It never allocates memory, which means it can be used while hooking allocation functions.
+/// nullptr can not be used as a key, since it marks empty slots.
+template<size_t Capacity>
+class DetoursFlatPointerMap
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    struct Entry
+    {
+        void* key;
+        void* value;
+    };
+
+    // Past this load, probe sequences get too long.
+    static const size_t maxEntries = Capacity / 4 * 3;
+
+    /// Returns the entry of key, inserting {key, value} if it was not in the map, as reported by inserted.
+    /// Returns nullptr if key had to be inserted but the map is full.
+    Entry* Insert(void* key, void* value, bool& inserted)
+    {
+        inserted = false;
+        for (size_t slot = Slot(key);; slot = (slot + 1) & (Capacity - 1))
+        {
+            Entry& entry = entries[slot];
+            if (entry.key == key) return &entry;
+            if (entry.key == nullptr)
+            {
+                if (nbEntries == maxEntries) return nullptr;
+                entry    = {key, value};
+                inserted = true;
+                nbEntries++;
+                return &entry;
+            }
+        }
+    }
+
+    const Entry* Find(const void* key) const
+    {
+        for (size_t slot = Slot(key);; slot = (slot + 1) & (Capacity - 1))
+        {
+            const Entry& entry = entries[slot];
+            if (entry.key == key) return &entry;
+            if (entry.key == nullptr) return nullptr;
+        }
+    }
+
+    bool Erase(const void* key)
+    {
+        size_t slot = Slot(key);
+        for (;; slot = (slot + 1) & (Capacity - 1))
+        {
+            if (entries[slot].key == key) break;
+            if (entries[slot].key == nullptr) return false;
+        }
+        // Shift back the following entries of the probe sequence, so that lookups do not stop at the freed slot.
+        for (size_t nextSlot = (slot + 1) & (Capacity - 1); entries[nextSlot].key != nullptr;
+             nextSlot        = (nextSlot + 1) & (Capacity - 1))
+        {
+            const size_t idealSlot = Slot(entries[nextSlot].key);
+            // Distance from the ideal slot, taking wrap around into account
+            if (((nextSlot - idealSlot) & (Capacity - 1)) >= ((nextSlot - slot) & (Capacity - 1)))
+            {
+                entries[slot] = entries[nextSlot];
+                slot          = nextSlot;
+            }
+        }
+        entries[slot] = {};
+        nbEntries--;
+        return true;
+    }
+
+    size_t Size() const { return nbEntries; }
+
+private:
+    static size_t Slot(const void* key)
+    {
+        // Addresses are aligned and close to each other, mix the bits so that they spread over the table.
+        uint32_t hash = uint32_t(uintptr_t(key));
+        hash ^= hash >> 16;
+        hash *= 0x45D9F3Bu;
+        hash ^= hash >> 16;
+        return hash & (Capacity - 1);
+    }
+
+    Entry  entries[Capacity] = {};
+    size_t nbEntries         = 0;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/// Fast non-cryptographic 64bit hash, used to detect content changes in caches.
+/// Reads 8 bytes per step so that hashing whole files stays cheap compared to loading them.
+inline uint64_t DetoursHash64(const void* data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    const uint8_t* bytes      = static_cast<const uint8_t*>(data);
+    uint64_t       hash       = seed ^ (size * multiplier);
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), bytes += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes, size);
+    hash = (hash ^ tail) * multiplier;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "DetoursHookStats.h"
+
 #include <Windows.h>
+#include <string>
+#include <vector>
 
 bool DetoursAttachLoadLibraryFunctions();
 bool DetoursDetachLoadLibraryFunctions();
@@ -12,13 +16,24 @@ void DetoursRegisterDllPatch(const wchar_t* dllName, const wchar_t* patchFolder,
                              void* userContext);
 void DetoursApplyPatches();
 
+/// Read the names of the modules a patch dll wants to patch from its NameOfModulesToPatch resource.
+/// If the dll has no such resource, it is expected to patch the module with the same name.
+/// Returns false if the dll must not be used as a patch.
+bool DetoursReadDllPatchTargets(const wchar_t* fullDllPath, std::vector<std::wstring>& targetModules);
+/// Same as DetoursRegisterDllPatch, for targets that were already read with DetoursReadDllPatchTargets
+void DetoursRegisterDllPatchTargets(const wchar_t* dllName, const wchar_t* patchFolder,
+                                    const std::vector<std::wstring>& targetModules,
+                                    DetoursDllPatchFunction patchFunction, void* userContext);
+
 /// See GetHookOrdinalInfo
 template<class FuncType>
 struct DllOrdinalHookInfo
 {
-    int       ordinal;
-    FuncType  hookFunction;
-    FuncType& realFunction;
+    int               ordinal;
+    FuncType          hookFunction;
+    FuncType&         realFunction;
+    // Only recorded by hooks using DetoursHookScope
+    DetoursHookStats& stats;
 };
 
 /// Helper so that you don't need to repeat functions prototypes and store the pointers yourself
@@ -26,8 +41,9 @@ struct DllOrdinalHookInfo
 template<int ordinal, class T>
 inline DllOrdinalHookInfo<T> GetHookOrdinalInfo(T func)
 {
-    static T realFunctionPtr = nullptr;
-    return {ordinal, func, realFunctionPtr};
+    static T                realFunctionPtr = nullptr;
+    static DetoursHookStats stats{ordinal};
+    return {ordinal, func, realFunctionPtr, stats};
 }
 
 /// A typeless version of DllOrdinalHookInfo to be used with GetHookOrdinalInfo if you want to build a container of hooks
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * Handlers of a function hooked by several patch dlls, called in priority order.
+ * The original function is detoured once, to a stub jumping through a single pointer to the first handler. Each handler
+ * continues the chain by calling its next function pointer, which is the next handler, and the last one calls the
+ * Detours trampoline. Calls thus go through one detour and one trampoline however many handlers there are.
+ * Handlers are added to the chain when the patch transaction commits: every pointer is written before the handler
+ * becomes reachable, so that threads running the function never see a partially built chain.
+ * Only the stub depends on the platform, see DetoursAllocateJumpStub.
+ */
+class DetoursHookChain
+{
+public:
+    /// Returns nullptr if the stub could not be allocated.
+    static DetoursHookChain* Create(void* originalFunction);
+
+    DetoursHookChain(const DetoursHookChain&) = delete;
+    DetoursHookChain& operator=(const DetoursHookChain&) = delete;
+
+    void* GetOriginalFunction() const { return originalFunction; }
+    /// The original function must be detoured to this address.
+    void* GetStub() const { return stub; }
+    /// The trampoline given by DetourAttachEx, the stub jumps to it while the chain is empty.
+    void  SetTrampoline(void* detoursTrampoline);
+
+    bool   Contains(void* handler) const;
+    bool   HasCommittedHandlers() const;
+    size_t GetNbHandlers() const { return handlers.size(); }
+
+    /// Handlers with a higher priority are called first, and those with the same priority in the order they were added.
+    /// nextFunctionStorage may be nullptr if the handler never continues the chain.
+    void AddPending(void* handler, int priority, void** nextFunctionStorage);
+    /// Link the pending handlers into the chain.
+    void Commit();
+    /// Forget the pending handlers.
+    void Abort();
+
+private:
+    struct Handler
+    {
+        void*  function;
+        int    priority;
+        bool   pending;
+        void** nextFunctionStorage;
+        // Used when the patch did not provide storage.
+        void*  ownNextFunction;
+    };
+
+    explicit DetoursHookChain(void* originalFunction) : originalFunction(originalFunction) {}
+
+    void* const                           originalFunction;
+    void*                                 stub       = nullptr;
+    void*                                 trampoline = nullptr;
+    // Read by the stub, must not move.
+    void* volatile                        firstFunction = nullptr;
+    std::vector<std::unique_ptr<Handler>> handlers;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef DETOURS_HOOK_INSTRUMENTATION
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+/// Gives each thread its own slot in DetoursHookStats and DetoursCounter, so that recording does not contend.
+/// The first maxSlots - 1 threads own a slot, the others share the last one.
+class DetoursThreadSlots
+{
+public:
+    static const unsigned maxSlots = 8;
+
+    static unsigned GetIndex()
+    {
+        static std::atomic<unsigned>       nextThreadIndex{0};
+        static thread_local const unsigned threadIndex = nextThreadIndex.fetch_add(1, std::memory_order_relaxed);
+        return threadIndex < maxSlots - 1 ? threadIndex : maxSlots - 1;
+    }
+
+    /// Only the owner thread writes to its slot, so a plain load and store is enough and avoids the locked
+    /// instruction, the dump may just read a value that is a few calls late.
+    template<class T>
+    static void Add(std::atomic<T>& counter, T value, unsigned slotIndex)
+    {
+        if (slotIndex == maxSlots - 1)
+            counter.fetch_add(value, std::memory_order_relaxed);
+        else
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+/// Calls count and latency histogram of a hook, see DetoursHookScope.
+/// Each thread records into its own cache line, so recording never locks, allocates nor contends with other threads.
+class DetoursHookStats
+{
+public:
+    static const unsigned maxThreadSlots     = DetoursThreadSlots::maxSlots;
+    /// Bucket i counts the calls that took [2^i, 2^(i+1)) cycles
+    static const unsigned nbHistogramBuckets = 40;
+
+    /// Registers the stats to be dumped by DetoursDumpHookStats, they must thus have a static lifetime.
+    explicit DetoursHookStats(int hookOrdinal) : ordinal(hookOrdinal)
+    {
+        std::atomic<DetoursHookStats*>& list = List();
+        next = list.load(std::memory_order_relaxed);
+        while (!list.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Record(uint64_t cycles)
+    {
+        const unsigned slotIndex = DetoursThreadSlots::GetIndex();
+        ThreadSlot&    slot      = slots[slotIndex];
+        DetoursThreadSlots::Add(slot.calls, uint64_t(1), slotIndex);
+        DetoursThreadSlots::Add(slot.totalCycles, cycles, slotIndex);
+        DetoursThreadSlots::Add(slot.histogram[HistogramBucket(cycles)], uint32_t(1), slotIndex);
+    }
+
+private:
+    friend void DetoursDumpHookStatsImpl();
+
+    struct alignas(64) ThreadSlot
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> totalCycles{0};
+        std::atomic<uint32_t> histogram[nbHistogramBuckets] = {};
+    };
+
+    // Intrusive list so that registering does not allocate
+    static std::atomic<DetoursHookStats*>& List()
+    {
+        static std::atomic<DetoursHookStats*> list{nullptr};
+        return list;
+    }
+
+    static unsigned HistogramBucket(uint64_t cycles)
+    {
+        unsigned bucket = 0;
+        while (cycles > 1 && bucket + 1 < nbHistogramBuckets)
+        {
+            cycles >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    int               ordinal;
+    ThreadSlot        slots[maxThreadSlots];
+    DetoursHookStats* next = nullptr;
+};
+
+/// Named event counter, such as cache hits, dumped along with the hooks stats.
+/// Counting is always enabled: each thread counts in its own cache line, as DetoursHookStats records.
+class DetoursCounter
+{
+public:
+    /// Registers the counter to be dumped by DetoursDumpHookStats, it must thus have a static lifetime.
+    explicit DetoursCounter(const char* counterName) : name(counterName)
+    {
+        std::atomic<DetoursCounter*>& list = List();
+        next = list.load(std::memory_order_relaxed);
+        while (!list.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Add(uint64_t value = 1)
+    {
+        const unsigned slotIndex = DetoursThreadSlots::GetIndex();
+        DetoursThreadSlots::Add(slots[slotIndex].count, value, slotIndex);
+    }
+    uint64_t Get() const
+    {
+        uint64_t count = 0;
+        for (const ThreadSlot& slot : slots)
+            count += slot.count.load(std::memory_order_relaxed);
+        return count;
+    }
+
+private:
+    friend void DetoursDumpHookStatsImpl();
+
+    static std::atomic<DetoursCounter*>& List()
+    {
+        static std::atomic<DetoursCounter*> list{nullptr};
+        return list;
+    }
+
+    struct alignas(64) ThreadSlot
+    {
+        std::atomic<uint64_t> count{0};
+    };
+
+    const char*     name;
+    ThreadSlot      slots[DetoursThreadSlots::maxSlots];
+    DetoursCounter* next = nullptr;
+};
+
+/// Records a call of the hook for the lifetime of the scope, if DETOURS_HOOK_INSTRUMENTATION is defined.
+/// Usage: `DetoursHookScope scope(GetHookOrdinalInfo<ordinal>(detourFunction).stats);` at the start of the hook.
+class DetoursHookScope
+{
+public:
+#ifdef DETOURS_HOOK_INSTRUMENTATION
+    explicit DetoursHookScope(DetoursHookStats& hookStats) : stats(hookStats), start(__rdtsc()) {}
+    ~DetoursHookScope() { stats.Record(__rdtsc() - start); }
+
+private:
+    DetoursHookStats& stats;
+    uint64_t          start;
+#else
+    explicit DetoursHookScope(DetoursHookStats&) {}
+#endif
+};
+
+extern "C"
+{
+    /// Log the stats of every hook that was called, sorted by calls count, and the counters.
+    /// Called when D2.Detours is unloaded, and exported so that it can be called at any time.
+    void __cdecl DetoursDumpHookStats();
+}
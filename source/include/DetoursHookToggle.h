@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lets a hook be disabled and enabled again while the game runs, without a Detours transaction.
+ * The original function is detoured to a stub testing the flag of the hook, instead of the patch function:
+ *
+ *         cmp byte ptr [enabled], 0
+ *         je  disabled
+ *         jmp dword ptr [patchFunction]
+ *     disabled:
+ *         jmp dword ptr [trampoline]
+ *
+ * Toggling is a single store, and calls only pay for a predicted branch and an indirect jump.
+ * Hooks are only toggleable if DIABLO2_PATCH_HOOK_TOGGLES is set to 1 when they are installed, in which case every
+ * hook attached with DetoursPatchTransactionAttach gets one: those of ApplyPatchAction, ReplaceAnyFunction and the
+ * ordinal hooks of D2.Detours itself. Hook chains are not toggleable.
+ */
+class DetoursHookToggle
+{
+public:
+    /// Returns nullptr if the stub could not be allocated. Hooks are enabled by default.
+    static DetoursHookToggle* Create(void* originalFunction, void* patchFunction);
+
+    DetoursHookToggle(const DetoursHookToggle&) = delete;
+    DetoursHookToggle& operator=(const DetoursHookToggle&) = delete;
+
+    void* GetOriginalFunction() const { return originalFunction; }
+    /// The original function must be detoured to this address.
+    void* GetStub() const { return stub; }
+    /// The trampoline given by DetourAttachEx, which is called while the hook is disabled.
+    void  SetTrampoline(void* detoursTrampoline) { trampoline = detoursTrampoline; }
+
+    void SetEnabled(bool enable) { enabled.store(enable ? 1 : 0, std::memory_order_relaxed); }
+    bool IsEnabled() const { return enabled.load(std::memory_order_relaxed) != 0; }
+
+private:
+    DetoursHookToggle(void* originalFunction, void* patchFunction)
+        : originalFunction(originalFunction), patchFunction(patchFunction)
+    {
+    }
+
+    void* const          originalFunction;
+    // Read by the stub, must not move.
+    std::atomic<uint8_t> enabled{1};
+    void* const          patchFunction;
+    void* volatile       trampoline = nullptr;
+    void*                stub       = nullptr;
+};
+
+/// Returns true if the hooks must be installed through a DetoursHookToggle, see DIABLO2_PATCH_HOOK_TOGGLES.
+bool   DetoursUseHookToggles();
+/// The registry takes ownership of the toggle, which can then be found by the address of its original function.
+bool   DetoursRegisterHookToggle(DetoursHookToggle* toggle);
+/// Unregister the toggles registered since the checkpoint, for transaction rollbacks.
+size_t DetoursHookTogglesCheckpoint();
+void   DetoursHookTogglesRollback(size_t checkpoint);
+
+extern "C"
+{
+    /// Disable or enable the hook of originalFunction, the address that was given to ApplyPatchAction or
+    /// ReplaceAnyFunction.
+    /// The new state is used by the next calls of the function, the calls in progress are not affected.
+    /// Returns false if the function has no toggleable hook. Must not be called while dlls are being patched.
+    bool __cdecl DetoursSetHookEnabled(void* originalFunction, bool enabled);
+    /// Same as DetoursSetHookEnabled, for an ordinal of a loaded module such as `D2Common.dll`.
+    bool __cdecl DetoursSetOrdinalHookEnabled(const wchar_t* moduleName, int ordinal, bool enabled);
+}
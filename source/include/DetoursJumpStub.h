@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Copies code to executable memory, returns nullptr on failure.
+/// Stubs are never freed, as a thread could still be running them, so what they reference must stay valid.
+void* DetoursAllocateStub(const uint8_t* code, size_t codeSize);
+
+/// Returns a stub running `jmp dword ptr [jumpTarget]`, which can be called with any calling convention and detoured
+/// like a function. Only supported on x86.
+void* DetoursAllocateJumpStub(void* const volatile* jumpTarget);
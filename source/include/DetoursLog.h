@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Messages below DETOURS_LOG_LEVEL are compiled out, see LOG_VERBOSE in Log.h
+#define DETOURS_LOG_LEVEL_VERBOSE 0
+#define DETOURS_LOG_LEVEL_INFO 1
+#ifndef DETOURS_LOG_LEVEL
+#define DETOURS_LOG_LEVEL DETOURS_LOG_LEVEL_INFO
+#endif
+
+/// A message formatted by the calling thread, and written by the logging thread.
+/// Formatting is cheap compared to OutputDebugString, which is very slow when a debugger is attached, and
+/// formatting eagerly means that the arguments do not need to outlive the call.
+struct DetoursLogRecord
+{
+    static const size_t maxBytes = 512;
+
+    union
+    {
+        char    text[maxBytes];
+        wchar_t wideText[maxBytes / sizeof(wchar_t)];
+    };
+    // In characters
+    uint32_t length;
+    bool     isWide;
+    // Position of the record in the queue, used by DetoursLogPublish
+    size_t   position;
+};
+
+/// Reserve a record in the lock-free queue. If the queue is full, waits for the logging thread or writes the queued
+/// messages itself, for example while the loader lock prevents the logging thread from running.
+/// Never returns nullptr, and must always be followed by DetoursLogPublish.
+DetoursLogRecord* DetoursLogReserve();
+/// Hand the record to the logging thread, `length` may be greater than the capacity if the message was truncated.
+void              DetoursLogPublish(DetoursLogRecord* record, size_t length, bool isWide);
+/// Write all the published messages from the calling thread, for example before the process exits.
+void              DetoursLogFlush();
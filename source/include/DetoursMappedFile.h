@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+
+/// Read-only view of a whole file, mapped in memory.
+struct DetoursMappedFile
+{
+    explicit DetoursMappedFile(const wchar_t* path);
+    ~DetoursMappedFile();
+
+    DetoursMappedFile(const DetoursMappedFile&) = delete;
+    DetoursMappedFile& operator=(const DetoursMappedFile&) = delete;
+
+    explicit operator bool() const { return data != nullptr; }
+
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+};
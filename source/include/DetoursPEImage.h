@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Minimal PE32 reader that does not depend on the Windows loader nor allocate memory.
+/// It can read either a file mapped as is (for example with DetoursMappedFile), or a module mapped by the loader.
+/// Every access is bounds checked so that it is safe to use on untrusted files.
+class DetoursPEImage
+{
+public:
+    enum class Layout
+    {
+        File,  // Raw file content, RVAs are translated using the sections table
+        Image, // Loaded module, RVAs are offsets from the base
+    };
+
+    struct Section
+    {
+        char     name[8];
+        uint32_t virtualAddress;
+        uint32_t virtualSize;
+        uint32_t rawDataOffset;
+        uint32_t rawDataSize;
+        uint32_t characteristics;
+    };
+
+    struct ExportDirectory
+    {
+        uint32_t ordinalBase      = 0;
+        uint32_t nbFunctions      = 0;
+        uint32_t functionsRva     = 0;
+        // Used to detect forwarded exports, whose RVA points inside the export directory
+        uint32_t directoryRva     = 0;
+        uint32_t directorySize    = 0;
+    };
+
+    static const uint32_t sectionExecutable = 0x20000000; // IMAGE_SCN_MEM_EXECUTE
+
+    DetoursPEImage(const void* base, size_t size, Layout layout);
+
+    bool IsValid() const { return ntHeadersOffset != 0; }
+
+    uint32_t GetTimeDateStamp() const;
+    uint32_t GetCheckSum() const;
+    uint32_t GetSizeOfImage() const;
+
+    uint16_t GetSectionsCount() const { return nbSections; }
+    bool     GetSection(uint16_t sectionIndex, Section& section) const;
+
+    /// Returns a pointer to size bytes at the given RVA, or nullptr if they are not all available in the view.
+    const uint8_t* RvaToPointer(uint32_t rva, size_t size) const;
+
+    bool GetExportDirectory(ExportDirectory& exportDirectory) const;
+    /// Returns the RVA of the function exported with the given ordinal, 0 if there is none.
+    uint32_t GetExportRva(const ExportDirectory& exportDirectory, uint32_t ordinal) const;
+    static bool IsForwardedExport(const ExportDirectory& exportDirectory, uint32_t rva)
+    {
+        return rva - exportDirectory.directoryRva < exportDirectory.directorySize;
+    }
+
+    /// Find a resource using its type id and name (case insensitive, as FindResource).
+    /// The first language available is used.
+    bool FindResource(uint16_t typeId, const char* name, const uint8_t*& data, uint32_t& dataSize) const;
+
+private:
+    bool     GetDataDirectory(uint32_t directoryIndex, uint32_t& rva, uint32_t& size) const;
+    uint32_t FindResourceEntry(uint32_t resourceRva, uint32_t resourceSize, uint32_t directoryOffset, uint16_t id,
+                               const char* name) const;
+
+    const uint8_t* base;
+    size_t         size;
+    Layout         layout;
+    uint32_t       ntHeadersOffset   = 0;
+    uint32_t       sectionsOffset    = 0;
+    uint16_t       nbSections        = 0;
+    uint32_t       sizeOfHeaders     = 0;
+};
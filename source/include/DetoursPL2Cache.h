@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Keeps the PL2 files built by CreateD2Palette (D2CMP ordinal 10000), keyed by the content of the palette they were
+ * built from, so that switching back to a palette does not rebuild all of its light, gamma and blend tables.
+ * Every hit returns a private copy, allocated by the caller with the allocator of the game, so that the game can
+ * modify and free it like the PL2 files it builds. The cached entries are only read by the cache, and are read-only
+ * so that a stray write faults instead of changing the PL2 of later hits.
+ * Entries are evicted, oldest first, to stay within the memory budget.
+ * Entries can be persisted to a file: its entries are mapped at startup and new ones are appended to it, so that later
+ * runs do not build them at all.
+ */
+class DetoursPL2Cache
+{
+public:
+    static const size_t pl2Size      = 443175;
+    /// CreateD2Palette is given the content of an act pal.dat file: 256 entries of 3 bytes.
+    static const size_t paletteBytes = 256 * 3;
+
+    /// Identifies the build of D2CMP, as the PL2 files it builds may differ between versions.
+    struct BuilderKey
+    {
+        uint32_t timeDateStamp = 0;
+        uint32_t checkSum      = 0;
+        uint32_t sizeOfImage   = 0;
+    };
+
+    /// Mapped entries and new ones share memoryBudget bytes.
+    DetoursPL2Cache(size_t memoryBudget, BuilderKey builderKey);
+    ~DetoursPL2Cache();
+
+    DetoursPL2Cache(const DetoursPL2Cache&) = delete;
+    DetoursPL2Cache& operator=(const DetoursPL2Cache&) = delete;
+
+    /// Map the entries saved to this file by previous runs, and append the new ones to it.
+    /// Returns false if there were no valid entries, in which case the file will be replaced.
+    bool MapFile(const std::wstring& filePath);
+
+    /// Returns a copy of the PL2 built from a palette with the same content, or nullptr.
+    /// The copy is written to allocate(pl2Size), which is only called on a hit and may return nullptr.
+    void* Find(const uint8_t* palette, void* (*allocate)(size_t size));
+    /// Copy the PL2 built from the palette, returns false if it could not be stored.
+    bool  Store(const uint8_t* palette, const void* pl2);
+
+private:
+    struct EntryHeader
+    {
+        uint64_t paletteHash;
+        uint8_t  palette[paletteBytes];
+    };
+    // Followed by the PL2. Entries are aligned in the file to the allocation granularity, so that each of them can be
+    // mapped and unmapped on its own.
+    static const size_t entryAlignment = 0x10000;
+    static const size_t entrySize      = (sizeof(EntryHeader) + pl2Size + entryAlignment - 1) & ~(entryAlignment - 1);
+
+    struct FileHeader
+    {
+        uint32_t   magic;
+        uint32_t   version;
+        BuilderKey builder;
+        uint32_t   entrySize;
+    };
+
+    struct Entry
+    {
+        EntryHeader* header;
+        bool         isMapped;
+    };
+
+    void EvictOldestEntry();
+    void ReleaseEntry(const Entry& entry);
+    bool AppendToFile(const EntryHeader* header);
+
+    const size_t       memoryBudget;
+    const BuilderKey   builderKey;
+    std::mutex         mutex;
+    // Oldest first
+    std::vector<Entry> entries;
+    std::wstring       path;
+    bool               replaceFile = false;
+};
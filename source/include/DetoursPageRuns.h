@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// A pointer write that is delayed until the pages containing it are made writable.
+struct DetoursPointerWrite
+{
+    void** address;
+    void*  value;
+    // If set, value is read from source when the writes are flushed instead.
+    void* const* source = nullptr;
+};
+
+/// Reads the values of the writes with a source, in queue order. A source written by an earlier write gets the value
+/// of that write, as if the writes had been done one after the other.
+inline void DetoursResolvePointerWrites(std::vector<DetoursPointerWrite>& writes)
+{
+    // Latest value queued for each address
+    std::unordered_map<void* const*, void*> queuedValues;
+    for (DetoursPointerWrite& write : writes)
+    {
+        if (write.source)
+        {
+            const auto queuedValueIt = queuedValues.find(write.source);
+            write.value  = queuedValueIt != queuedValues.end() ? queuedValueIt->second : *write.source;
+            write.source = nullptr;
+        }
+        queuedValues[write.address] = write.value;
+    }
+}
+
+/**
+ * Groups the pending writes by runs of contiguous pages, so that protections can be changed once per run instead of
+ * once per pointer.
+ * Sorts the writes by address, keeping the queue order of the writes to the same address, then calls
+ * `onPageRun(runBegin, runEnd, firstWrite, lastWrite)` for each run. [runBegin, runEnd) is page aligned and contains
+ * the writes [firstWrite, lastWrite).
+ * This does not depend on the OS so that it can be tested anywhere, pageSize must be a power of 2.
+ */
+template<class OnPageRun>
+void DetoursForEachPageRun(std::vector<DetoursPointerWrite>& writes, uintptr_t pageSize, const OnPageRun& onPageRun)
+{
+    std::stable_sort(writes.begin(), writes.end(), [](const DetoursPointerWrite& lhs, const DetoursPointerWrite& rhs) {
+        return uintptr_t(lhs.address) < uintptr_t(rhs.address);
+    });
+
+    const uintptr_t pageMask = ~(pageSize - 1);
+    auto            runFirst = writes.begin();
+    while (runFirst != writes.end())
+    {
+        const uintptr_t runBegin = uintptr_t(runFirst->address) & pageMask;
+        // Unaligned pointers may straddle two pages.
+        uintptr_t runEnd  = (uintptr_t(runFirst->address) + sizeof(void*) + pageSize - 1) & pageMask;
+        auto      runLast = runFirst + 1;
+        for (; runLast != writes.end() && (uintptr_t(runLast->address) & pageMask) <= runEnd; ++runLast)
+            runEnd = std::max(runEnd, (uintptr_t(runLast->address) + sizeof(void*) + pageSize - 1) & pageMask);
+
+        onPageRun(runBegin, runEnd, &*runFirst, &*runFirst + (runLast - runFirst));
+        runFirst = runLast;
+    }
+}
+
+/**
+ * First step of a flush: resolves the values of the writes, then calls `makeWritable(runBegin, runEnd)` for each run
+ * of pages, which returns false if it failed. Stops at the first failure and returns false, in which case the caller
+ * must restore the runs it already made writable and not write anything.
+ * The writes are sorted by address, so that DetoursApplyPointerWrites can then write them page after page.
+ */
+template<class MakeWritable>
+bool DetoursMakePointerWritesWritable(std::vector<DetoursPointerWrite>& writes, uintptr_t pageSize,
+                                      const MakeWritable& makeWritable)
+{
+    DetoursResolvePointerWrites(writes);
+    bool writable = true;
+    DetoursForEachPageRun(writes, pageSize,
+                          [&](uintptr_t runBegin, uintptr_t runEnd, const DetoursPointerWrite*,
+                              const DetoursPointerWrite*) { writable = writable && makeWritable(runBegin, runEnd); });
+    return writable;
+}
+
+/// Second step of a flush, once DetoursMakePointerWritesWritable succeeded.
+inline void DetoursApplyPointerWrites(const std::vector<DetoursPointerWrite>& writes)
+{
+    for (const DetoursPointerWrite& write : writes)
+        *write.address = write.value;
+}
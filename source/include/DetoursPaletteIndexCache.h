@@ -0,0 +1,137 @@
+#pragma once
+
+#include "DetoursHash.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+/**
+ * Remembers the palette index returned for each color by D2GetNearestPaletteIndex or D2GetFarthestPaletteIndex, per
+ * palette, so that the shade tables generation loops do not run a 256 entries search for every color.
+ * Misses are computed by the caller, usually with the original function, so the results are always identical to it.
+ * Palettes are identified by their address, size and a snapshot of a few words spread over their content, so that a
+ * hit does not read the whole palette. Misses also hash the whole content, and a slot whose palette changed without
+ * changing its snapshot is replaced then: such an in-place modification is only seen from the next miss on. D2 builds
+ * its palettes whole, so this only matters to code writing a few entries of a palette in use.
+ * Hits do not lock nor write shared memory: slots are read under a sequence lock, and the entries of the lookup tables
+ * are tagged atomic words. Only misses may lock, to replace a slot or allocate its table.
+ * Only depends on the standard library so that it can be used and tested on any platform.
+ */
+class DetoursPaletteIndexCache
+{
+public:
+    /// Number of misses with the same palette before a lookup table is allocated for it.
+    static const unsigned promotionThreshold = 64;
+    static const unsigned maxPalettes        = 4;
+    /// Lookup tables are direct mapped, with 2^tableBits colors.
+    static const unsigned tableBits          = 14;
+    static const unsigned nbTableEntries     = 1u << tableBits;
+    /// Number of 4 bytes words of the palette compared by every lookup.
+    static const unsigned nbSnapshotWords    = 8;
+
+    /// Returns the index of the color in the palette lookup table, or the result of `computeIndex()` on a miss.
+    /// `paletteBytes` must cover every byte of the palette that the original function may read.
+    template<class ComputeIndex>
+    uint8_t Get(const uint8_t* palette, int paletteSize, size_t paletteBytes, int red, int green, int blue,
+                const ComputeIndex& computeIndex)
+    {
+        // Components out of range can not be packed, and are not produced by the game anyway.
+        if ((unsigned(red) | unsigned(green) | unsigned(blue)) > 0xFF) return computeIndex();
+
+        PaletteKey key{palette, paletteSize, {}};
+        ReadSnapshot(palette, paletteBytes, key.snapshot);
+        const uint32_t color = uint32_t(red) << 16 | uint32_t(green) << 8 | uint32_t(blue);
+        SlotVersion    version;
+        uint8_t        index;
+        if (Lookup(key, color, version, index)) return index;
+        index           = computeIndex();
+        key.paletteHash = DetoursHash64(palette, paletteBytes);
+        Store(key, color, version, index);
+        return index;
+    }
+
+private:
+    struct PaletteKey
+    {
+        const uint8_t* palette;
+        int            paletteSize;
+        uint32_t       snapshot[nbSnapshotWords];
+        // Only computed on misses
+        uint64_t       paletteHash = 0;
+    };
+
+    // Entries are (generation << 19) | valid | (tag << 8) | index. The entry index and tag of a color are the high and
+    // low bits of a bijective mix of its 24 bits.
+    static const uint32_t entryTagBits         = 24 - tableBits;
+    static const uint32_t entryValidBit        = 1u << (8 + entryTagBits);
+    static const uint32_t entryGenerationShift = 9 + entryTagBits;
+    static const uint32_t entryGenerationMask  = (1u << (32 - entryGenerationShift)) - 1;
+
+    struct Table
+    {
+        std::atomic<uint32_t> entries[nbTableEntries];
+    };
+    struct PaletteSlot
+    {
+        // Odd while the key is being replaced, its half is the generation of the table entries.
+        std::atomic<uint32_t>       sequence{0};
+        std::atomic<const uint8_t*> palette{nullptr};
+        std::atomic<int>            paletteSize{0};
+        std::atomic<uint32_t>       snapshot[nbSnapshotWords] = {};
+        // Split as 64bit atomics are not lock free on every x86 compiler.
+        std::atomic<uint32_t>       paletteHashLow{0};
+        std::atomic<uint32_t>       paletteHashHigh{0};
+        std::atomic<unsigned>       nbMisses{0};
+        // Set by hits, cleared when the clock hand passes the slot.
+        std::atomic<bool>           recentlyUsed{false};
+        // Kept when the slot is replaced, older generations of entries being ignored.
+        std::atomic<Table*>         table{nullptr};
+    };
+    /// Slot the palette was found in, and the sequence it had then.
+    struct SlotVersion
+    {
+        PaletteSlot* slot     = nullptr;
+        uint32_t     sequence = 0;
+    };
+
+    static uint32_t MixColor(uint32_t color) { return (color * 2654435761u) & 0xFFFFFF; }
+
+    /// Words spread evenly from the first to the last 4 bytes of the palette.
+    static void ReadSnapshot(const uint8_t* palette, size_t paletteBytes, uint32_t (&snapshot)[nbSnapshotWords])
+    {
+        if (paletteBytes < sizeof(uint32_t))
+        {
+            for (uint32_t& word : snapshot)
+                word = 0;
+            memcpy(&snapshot[0], palette, paletteBytes);
+            return;
+        }
+        const size_t lastOffset = paletteBytes - sizeof(uint32_t);
+        for (unsigned wordIndex = 0; wordIndex < nbSnapshotWords; wordIndex++)
+            memcpy(&snapshot[wordIndex], palette + lastOffset * wordIndex / (nbSnapshotWords - 1), sizeof(uint32_t));
+    }
+
+    enum class KeyMatch
+    {
+        None,
+        // Same address, size and snapshot, the content hash was not compared
+        Snapshot,
+        Full,
+    };
+
+    bool     Lookup(const PaletteKey& key, uint32_t color, SlotVersion& version, uint8_t& index);
+    void     Store(const PaletteKey& key, uint32_t color, const SlotVersion& version, uint8_t index);
+    KeyMatch ReadSlotKey(const PaletteSlot& slot, const PaletteKey& key, uint32_t& sequence) const;
+    void     ReplaceSlot(const PaletteKey& key);
+    void     RekeySlot(PaletteSlot& slot, const PaletteKey& key);
+
+    // Only taken by misses, to replace slots and allocate tables.
+    std::mutex             mutex;
+    PaletteSlot            slots[maxPalettes];
+    std::unique_ptr<Table> tables[maxPalettes];
+    unsigned               clockHand = 0;
+};
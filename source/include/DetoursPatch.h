@@ -8,7 +8,12 @@ enum class PatchAction
     FunctionReplacePatchByOriginal,
     PointerReplaceOriginalByPatch,
     PointerReplacePatchByOriginal,
-    Ignore
+    Ignore,
+    // Redirects the calls made by other modules through their Import Address Table, the original code is left untouched.
+    // Cheaper than FunctionReplaceOriginalByPatch since there is no trampoline, but calls from within the original
+    // module or through GetProcAddress pointers are not redirected.
+    // The real function pointer is the original function itself.
+    ImportReplaceOriginalByPatch,
 };
 
 struct ExtraPatchAction
@@ -50,6 +55,13 @@ extern "C"
     };
     typedef PatchInformationFunctions(__cdecl* GetPatchInformationFunctionsType)(const wchar_t* dllName);
 
+    // May be exported by the patch dll (as `GetPatchActionsTable`) instead of GetPatchAction.
+    // Returns the action to take for every ordinal from GetBaseOrdinal to GetLastOrdinal as a single array, which avoids
+    // one call per ordinal. Return nullptr to fall back to GetPatchAction.
+    // This is not part of PatchInformationFunctions as patch dlls built with an older version of this header would
+    // return a smaller structure.
+    typedef const PatchAction*(__cdecl* GetPatchActionsTableType)(const wchar_t* dllName);
+
     enum PatchActionReturn
     {
         PatchAction_Success,
@@ -76,6 +88,26 @@ extern "C"
 	typedef PatchActionReturn(__cdecl* ReplaceAnyFunctionType)(HookContext* context, void* originalFunction,
                                                             void* patchFunction, void** realPatchedFunctionStorage);
 
+	// Searches the executable sections of the original dll for a byte pattern such as "8B 44 24 ?? 56 E8 ?? ?? ?? ??",
+	// where `??` matches any byte. This lets a single patch support multiple game versions without offset tables.
+	// Fills up to maxOffsets offsets relative to the original dll base, which can be given as is to ApplyPatchAction.
+	// Returns the total number of matches (which may be greater than maxOffsets), so that you can check the pattern is unique.
+	// Returns 0 if the pattern is malformed.
+	typedef size_t(__cdecl* FindSignatureType)(HookContext* context, const char* pattern, uintptr_t* originalDllOffsets,
+                                                size_t maxOffsets);
+
+	// Adds patchFunction to the handlers of the function at originalDllOffset, so that several patch dlls may hook it.
+	// Handlers with a higher priority are called first, and those with the same priority in the order they were added.
+	// A handler continues the chain by calling *nextFunctionStorage, which is either the next handler or the original
+	// function, and must thus use the same calling convention. The storage is written when the patches are committed,
+	// and again when a handler is inserted after this one, so it must stay valid while the dll is loaded. It may be
+	// nullptr if the handler never continues the chain.
+	// Returns PatchAction_AlreadyPatched if the function was replaced with ApplyPatchAction, or if patchFunction is
+	// already in the chain.
+	typedef PatchActionReturn(__cdecl* ChainFunctionType)(HookContext* context, uintptr_t originalDllOffset,
+                                                          void* patchFunction, int priority,
+                                                          void** nextFunctionStorage);
+
     struct HookContext
     {
         void*                  pContextPrivateData;
@@ -83,6 +115,9 @@ extern "C"
         void*                  hPatchModule;    // The module containing the patch. May be safely casted to HMODULE
         ApplyPatchActionType   ApplyPatchAction;
         ReplaceAnyFunctionType ReplaceAnyFunction;
+        // New members are only appended, and are not available with older versions of D2.Detours.dll.
+        FindSignatureType      FindSignature;
+        ChainFunctionType      ChainFunction;
     };
 
 
@@ -100,6 +135,7 @@ extern "C"
 	//	}
 	// 
 	// Will be called before any patching is done, right after the first `LoadLibrary` call for the original .dll.
+	// It is only called once: if the patches have to be retried, the calls it made through ctx are replayed instead.
 	// Return 0 on success
 	// hOriginalDllModule and hPatchDllModule may be safely casted to HMODULE
     typedef uint32_t(__cdecl* DllPreLoadHookType)(HookContext* ctx, const wchar_t* dllName);
@@ -111,7 +147,35 @@ extern "C"
 /**
  * Patch hOriginalModule using a dll with a given path.
  * Ordinals patching is determined by the patch dll, and it must expose the functions in PatchInformationFunctions.
+ * Must be called inside a patch transaction.
+ */
+bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE hPatchModule);
+
+/**
+ * Detours transactions that can be nested, so that the patches of multiple dlls are committed at once.
+ * Only the outermost commit actually commits the Detours transaction, or aborts it if any of the nested transactions
+ * failed. Pointer patches are only written by the outermost commit, aborting discards them and rolls back the patch
+ * history.
  */
-bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE hPatchModule,
-                        std::vector<PVOID>& ordinalDetouredAddresses);
+bool DetoursPatchTransactionBegin();
+/// Mark the current transaction as failed, it will be aborted by the outermost commit.
+void DetoursPatchTransactionFail();
+/// Returns false if the transaction failed or was aborted.
+bool DetoursPatchTransactionCommit();
+/// Zero initialized storage that stays valid until the transaction ends, as needed by DetourAttach.
+PVOID* DetoursPatchTransactionAllocPointers(size_t count);
+/// Same as DetourAttach, except that the hook is installed through a DetoursHookToggle if DetoursUseHookToggles().
+LONG   DetoursPatchTransactionAttach(PVOID* realPatchedFunctionPtr, PVOID patchFunction);
+/// Log the number of commits and the time spent committing since the start of the process.
+void DetoursPatchTransactionLogStats();
+
+/// Signature scans results are cached in the given file, which is read immediately.
+void DetoursLoadSignatureCache(const wchar_t* cachePath);
+/// Write the signature scans results if any new pattern was scanned.
+void DetoursSaveSignatureCache();
+
+/// Apply the ImportReplaceOriginalByPatch patches to the imports of a newly loaded module.
+void DetoursPatchModuleImports(HMODULE hModule);
+/// Returns true if newly loaded modules need DetoursPatchModuleImports.
+bool DetoursHasImportPatches();
 #endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Cache of the modules targeted by the patch dlls of a folder.
+/// Reading the NameOfModulesToPatch resource of a patch requires the dll to be loaded, which can be avoided for the
+/// dlls that did not change since the cache was written.
+class DetoursPatchManifest
+{
+public:
+    /// Identifies a given version of a patch dll
+    struct FileKey
+    {
+        uint64_t size          = 0;
+        uint64_t lastWriteTime = 0;
+        uint64_t contentHash   = 0;
+
+        bool operator==(const FileKey& other) const
+        {
+            return size == other.size && lastWriteTime == other.lastWriteTime && contentHash == other.contentHash;
+        }
+    };
+
+    struct Entry
+    {
+        FileKey                   key;
+        // False if the dll must not be used as a patch (see DetoursReadDllPatchTargets)
+        bool                      isPatch = false;
+        std::vector<std::wstring> targetModules;
+    };
+
+    explicit DetoursPatchManifest(std::wstring manifestPath) : path(std::move(manifestPath)) {}
+
+    /// Load the manifest from disk, returns false if there was none or if it was invalid.
+    bool Load();
+    /// Write the entries that were looked up or stored since Load, if any of them changed.
+    bool SaveIfModified();
+
+    /// Compute the key of a patch dll from its size, last write time and content.
+    static bool ComputeFileKey(const wchar_t* fullDllPath, const WIN32_FIND_DATAW& findData, FileKey& key);
+
+    /// Returns the cached entry of the dll if it was stored with the same key, nullptr otherwise.
+    /// The entry is only valid until the next call to Find or Store.
+    const Entry* Find(const wchar_t* dllName, const FileKey& key);
+    void         Store(const wchar_t* dllName, Entry entry);
+
+private:
+    std::wstring                                  path;
+    std::unordered_map<std::wstring, Entry>       loadedEntries;
+    std::vector<std::pair<std::wstring, Entry>>   usedEntries;
+    bool                                          modified = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Modules already processed by DetoursApplyPatches, so that each LoadLibrary call only looks at the modules loaded
+ * since the previous one.
+ * Modules are identified by their address and an image identity such as the timestamp and size of their headers, since
+ * a new module may be loaded at the address of a module that was unloaded.
+ * This does not depend on the OS so that it can be tested anywhere.
+ */
+class DetoursSeenModules
+{
+public:
+    /// Returns true if the module was not seen yet, or if another image was loaded at its address since.
+    bool Insert(const void* module, uint32_t imageIdentity)
+    {
+        // Most modules were already seen, so look them up first instead of building a node to insert.
+        const auto moduleIt = modules.find(module);
+        if (moduleIt == modules.end())
+        {
+            modules.emplace(module, imageIdentity);
+            return true;
+        }
+        if (moduleIt->second == imageIdentity) return false;
+        moduleIt->second = imageIdentity;
+        return true;
+    }
+
+    void Clear() { modules.clear(); }
+
+    /// Calls onNewModule(module) for each module that was not seen yet, and marks it as seen.
+    /// enumerateModules(previous) returns the module following previous, or nullptr after the last one, as
+    /// DetourEnumerateModules does. getImageIdentity(module) is only called once per listed module.
+    template<class Module, class EnumerateModules, class GetImageIdentity, class OnNewModule>
+    void ForEachNewModule(const EnumerateModules& enumerateModules, const GetImageIdentity& getImageIdentity,
+                          const OnNewModule& onNewModule)
+    {
+        for (Module module = enumerateModules(Module(nullptr)); module != nullptr; module = enumerateModules(module))
+        {
+            if (Insert(module, getImageIdentity(module))) onNewModule(module);
+        }
+    }
+
+private:
+    std::unordered_map<const void*, uint32_t> modules;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "DetoursLog.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/// Memory read by a function through its pointer parameters, dumped with the mismatches so that they can be replayed.
+struct DetoursShadowMemory
+{
+    const void* data = nullptr;
+    size_t      size = 0;
+};
+
+/**
+ * Shadow execution of a replacement hook, to check it behaves as the original function before relying on it.
+ * A sample of the calls runs both the original function and the replacement, then compares their results and the time
+ * they took. The replacement result is always returned, so sampling does not change the behavior of the game.
+ * Samples alternate which of the two runs first, so that neither always pays for the cold caches.
+ * A sample is skipped, neither compared nor timed, if the replacement forwarded the call to the original function, or
+ * if the memory its inputs point to changed during the sample.
+ * DIABLO2_PATCH_SHADOW_RATE gives the number of calls between two samples, shadow execution is disabled if it is unset
+ * or 0. Mismatches are logged with the bytes of the inputs, of the memory they point to and of both results, see
+ * DetoursShadowMismatchLines.
+ * Results are reported by DetoursDumpHookStats, the sites must thus have a static lifetime.
+ */
+class DetoursShadowSite
+{
+public:
+    /// Only the first mismatches of each site are logged, the others are only counted.
+    static const unsigned maxLoggedMismatches = 16;
+
+    /// Samples one call every DIABLO2_PATCH_SHADOW_RATE calls.
+    explicit DetoursShadowSite(int ordinal);
+    /// Registers the site to be dumped by DetoursDumpShadowStats. A sampleRate of 0 disables sampling.
+    DetoursShadowSite(int siteOrdinal, uint32_t siteSampleRate) : ordinal(siteOrdinal), sampleRate(siteSampleRate)
+    {
+        std::atomic<DetoursShadowSite*>& list = List();
+        next = list.load(std::memory_order_relaxed);
+        while (!list.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /// originalFirst is set to which function must run first, it alternates from one sample to the next.
+    bool ShouldSample(bool& originalFirst)
+    {
+        if (sampleRate == 0) return false;
+        const uint32_t call = calls.fetch_add(1, std::memory_order_relaxed);
+        originalFirst       = (call / sampleRate) % 2 == 0;
+        return call % sampleRate == 0;
+    }
+
+    void RecordSample(uint64_t originalCycles, uint64_t replacementCycles)
+    {
+        samples.fetch_add(1, std::memory_order_relaxed);
+        totalOriginalCycles.fetch_add(originalCycles, std::memory_order_relaxed);
+        totalReplacementCycles.fetch_add(replacementCycles, std::memory_order_relaxed);
+    }
+
+    void RecordSkipped() { skipped.fetch_add(1, std::memory_order_relaxed); }
+
+    void RecordMismatch(const std::vector<uint8_t>& inputs, DetoursShadowMemory memory, const void* originalResult,
+                        const void* replacementResult, size_t resultSize)
+    {
+        const uint64_t mismatchIndex = mismatches.fetch_add(1, std::memory_order_relaxed);
+        if (mismatchIndex < maxLoggedMismatches)
+            LogMismatch(mismatchIndex, inputs, memory, originalResult, replacementResult, resultSize);
+    }
+
+    uint64_t GetNbSamples() const { return samples.load(std::memory_order_relaxed); }
+    uint64_t GetNbMismatches() const { return mismatches.load(std::memory_order_relaxed); }
+    uint64_t GetNbSkipped() const { return skipped.load(std::memory_order_relaxed); }
+
+private:
+    friend void DetoursDumpShadowStats();
+
+    // Intrusive list so that registering does not allocate
+    static std::atomic<DetoursShadowSite*>& List()
+    {
+        static std::atomic<DetoursShadowSite*> list{nullptr};
+        return list;
+    }
+
+    void LogMismatch(uint64_t mismatchIndex, const std::vector<uint8_t>& inputs, DetoursShadowMemory memory,
+                     const void* originalResult, const void* replacementResult, size_t resultSize) const;
+
+    const int             ordinal;
+    const uint32_t        sampleRate;
+    std::atomic<uint32_t> calls{0};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> mismatches{0};
+    std::atomic<uint64_t> skipped{0};
+    std::atomic<uint64_t> totalOriginalCycles{0};
+    std::atomic<uint64_t> totalReplacementCycles{0};
+    DetoursShadowSite*    next = nullptr;
+};
+
+template<class Input>
+void DetoursShadowAppendBytes(std::vector<uint8_t>& bytes, const Input& input)
+{
+    static_assert(std::is_trivially_copyable<Input>::value, "Inputs are dumped as bytes");
+    const uint8_t* inputBytes = reinterpret_cast<const uint8_t*>(&input);
+    bytes.insert(bytes.end(), inputBytes, inputBytes + sizeof(Input));
+}
+
+/// Bytes dumped per log line: the memory of a full palette does not fit in one DetoursLogRecord, so every dumped buffer
+/// is split in numbered parts, which are put back together by concatenating their hexadecimal in order.
+/// The longest line, with the log prefix and numbers of 20 digits, still fits in a record.
+static const size_t detoursShadowBytesPerLine = 176;
+
+/// The lines logged for a mismatch, without the log prefix. Each one names the mismatch and which part of which buffer
+/// it holds, so that interleaved lines of several threads or sites can still be told apart.
+inline std::vector<std::string> DetoursShadowMismatchLines(int ordinal, uint64_t mismatchIndex,
+                                                           const std::vector<uint8_t>& inputs,
+                                                           DetoursShadowMemory memory, const void* originalResult,
+                                                           const void* replacementResult, size_t resultSize)
+{
+    static const char hexDigits[] = "0123456789ABCDEF";
+    const struct
+    {
+        const char* name;
+        const void* data;
+        size_t      size;
+    } buffers[] = {{"inputs", inputs.data(), inputs.size()},
+                   {"memory", memory.data, memory.data ? memory.size : 0},
+                   {"original", originalResult, resultSize},
+                   {"replacement", replacementResult, resultSize}};
+
+    std::vector<std::string> lines;
+    for (const auto& buffer : buffers)
+    {
+        const uint8_t* const bytes = static_cast<const uint8_t*>(buffer.data);
+        // An empty buffer still gets its line, so that every mismatch has the same lines.
+        const size_t nbParts =
+            std::max<size_t>((buffer.size + detoursShadowBytesPerLine - 1) / detoursShadowBytesPerLine, 1);
+        for (size_t part = 0; part < nbParts; part++)
+        {
+            std::string line = "Shadow mismatch #" + std::to_string(mismatchIndex) + " of ordinal " +
+                               std::to_string(ordinal) + ": " + buffer.name + " " + std::to_string(part + 1) + "/" +
+                               std::to_string(nbParts) + "=";
+            const size_t begin = part * detoursShadowBytesPerLine;
+            const size_t end   = std::min(begin + detoursShadowBytesPerLine, buffer.size);
+            for (size_t i = begin; i < end; i++)
+            {
+                line.push_back(hexDigits[bytes[i] >> 4]);
+                line.push_back(hexDigits[bytes[i] & 0xF]);
+            }
+            line.push_back('\n');
+            lines.push_back(std::move(line));
+        }
+    }
+    return lines;
+}
+
+/// Returns callReplacement(forwarded, inputs...), and on sampled calls also calls callOriginal(inputs...) to compare
+/// the results. The replacement must set `bool& forwarded` to true when it calls the original function itself, such as
+/// on a cache miss, as the sample would then only compare the original function with itself.
+/// Both callables get their own copy of the inputs, but not of the memory they point to: describeMemory() returns that
+/// memory, which is saved before the sample and compared after it. Functions writing to memory through their
+/// parameters can thus not be compared this way, their samples are all skipped.
+template<class DescribeMemory, class CallOriginal, class CallReplacement, class... Inputs>
+auto DetoursShadowCall(DetoursShadowSite& site, const DescribeMemory& describeMemory, const CallOriginal& callOriginal,
+                       const CallReplacement& callReplacement, Inputs... inputs)
+    -> decltype(callOriginal(inputs...))
+{
+    using Result = decltype(callOriginal(inputs...));
+    static_assert(std::is_trivially_copyable<Result>::value, "Results are compared and dumped as bytes");
+    bool forwarded = false;
+    bool originalFirst;
+    if (!site.ShouldSample(originalFirst)) return callReplacement(forwarded, inputs...);
+
+    const DetoursShadowMemory  memory      = describeMemory();
+    const uint8_t* const       memoryBytes = static_cast<const uint8_t*>(memory.data);
+    const std::vector<uint8_t> memoryBefore(memoryBytes, memoryBytes + (memoryBytes ? memory.size : 0));
+
+    uint64_t   originalCycles    = 0;
+    uint64_t   replacementCycles = 0;
+    const auto runOriginal       = [&] {
+        const uint64_t start  = __rdtsc();
+        const Result   result = callOriginal(inputs...);
+        originalCycles        = __rdtsc() - start;
+        return result;
+    };
+    const auto runReplacement = [&] {
+        const uint64_t start  = __rdtsc();
+        const Result   result = callReplacement(forwarded, inputs...);
+        replacementCycles     = __rdtsc() - start;
+        return result;
+    };
+    const Result  firstResult       = originalFirst ? runOriginal() : runReplacement();
+    const Result  secondResult      = originalFirst ? runReplacement() : runOriginal();
+    const Result& originalResult    = originalFirst ? firstResult : secondResult;
+    const Result& replacementResult = originalFirst ? secondResult : firstResult;
+
+    const bool memoryChanged = memoryBytes && memcmp(memoryBefore.data(), memoryBytes, memoryBefore.size()) != 0;
+    if (forwarded || memoryChanged)
+    {
+        site.RecordSkipped();
+        return replacementResult;
+    }
+    site.RecordSample(originalCycles, replacementCycles);
+
+    if (!(originalResult == replacementResult))
+    {
+        std::vector<uint8_t> inputBytes;
+        (void)std::initializer_list<int>{(DetoursShadowAppendBytes(inputBytes, inputs), 0)...};
+        site.RecordMismatch(inputBytes, {memoryBefore.data(), memoryBefore.size()}, &originalResult,
+                            &replacementResult, sizeof(Result));
+    }
+    return replacementResult;
+}
+
+/// Log the samples count, mismatches count and speed ratio of every shadow site that was sampled.
+void DetoursDumpShadowStats();
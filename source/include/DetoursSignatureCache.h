@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Cache of the offsets found by signature scans, so that the same game build does not need to be scanned again.
+/// Entries are keyed by the identity of the scanned module and the hash of the pattern, so that the results for
+/// multiple game versions can be kept in the same file.
+/// Cached offsets must still be validated by the caller, as the key may collide.
+class DetoursSignatureCache
+{
+public:
+    /// Identifies a build of a module using its PE headers
+    struct ModuleKey
+    {
+        uint32_t timeDateStamp = 0;
+        uint32_t checkSum      = 0;
+        uint32_t sizeOfImage   = 0;
+    };
+
+    struct Entry
+    {
+        ModuleKey             module;
+        uint64_t              patternHash = 0;
+        // Total number of matches, more than offsets.size() if there were too many to be kept
+        uint32_t              nbMatches   = 0;
+        std::vector<uint32_t> offsets;
+    };
+
+    /// Only the first offsets are cached, scans for more matches are done again.
+    static const size_t maxCachedOffsets = 16;
+
+    explicit DetoursSignatureCache(std::wstring cachePath) : path(std::move(cachePath)) {}
+
+    /// Load the cache from disk, returns false if there was none or if it was invalid.
+    bool Load();
+    /// Write the cache if entries were stored since Load.
+    bool SaveIfModified();
+
+    const Entry* Find(const ModuleKey& module, uint64_t patternHash) const;
+    /// Add or replace an entry
+    void         Store(Entry entry);
+
+private:
+    static uint64_t EntryId(const ModuleKey& module, uint64_t patternHash);
+
+    std::wstring                        path;
+    std::unordered_map<uint64_t, Entry> entries;
+    bool                                modified = false;
+};
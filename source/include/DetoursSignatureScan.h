@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Byte pattern with wildcards, such as "8B 44 24 ?? 56 E8 ?? ?? ?? ??".
+/// Only depends on the standard library so that it can be used and tested on any platform.
+class DetoursSignature
+{
+public:
+    /// Hexadecimal bytes separated by spaces, `?` or `??` for a byte that can take any value.
+    /// Returns false if the pattern is malformed or has no byte at all.
+    bool Parse(const char* pattern);
+
+    size_t         Size() const { return bytes.size(); }
+    const uint8_t* Bytes() const { return bytes.data(); }
+    /// 0xFF for the bytes that must match, 0 for wildcards.
+    const uint8_t* Mask() const { return mask.data(); }
+
+    /// Returns the offset of the first match starting at or after `start`, or `size` if there is none.
+    size_t   Find(const uint8_t* data, size_t size, size_t start = 0) const;
+    /// Returns true if the pattern matches the Size() bytes at data.
+    bool     Matches(const uint8_t* data) const;
+    /// Identifies the pattern, wildcards included.
+    uint64_t Hash() const;
+
+private:
+    size_t FindHorspool(const uint8_t* data, size_t size, size_t start) const;
+    size_t FindSSE2(const uint8_t* data, size_t size, size_t start) const;
+    size_t FindAVX2(const uint8_t* data, size_t size, size_t start) const;
+
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+    // Fixed bytes used to filter the candidates before comparing the whole pattern.
+    // The first and last ones are used as they are the least likely to be correlated.
+    size_t firstAnchor = 0;
+    size_t lastAnchor  = 0;
+    bool   hasAnchor   = false;
+    // Horspool shifts, indexed by the byte aligned with the last byte of the pattern.
+    size_t shifts[256];
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+/// Startup timeline, written as Chrome trace_event JSON to the file named by DIABLO2_PATCH_TRACE_FILE, so that it can
+/// be opened with Perfetto or chrome://tracing. Does nothing if the variable is not set.
+/// Records are stored in a fixed size buffer, recording does not lock nor allocate.
+class DetoursTraceScope
+{
+public:
+    /// `name` must be a string literal. `detail` must stay valid until the end of the scope, and only its file name is
+    /// kept, which is enough to know which dll was being loaded or patched.
+    explicit DetoursTraceScope(const char* name, const wchar_t* detail = nullptr);
+    ~DetoursTraceScope();
+
+    DetoursTraceScope(const DetoursTraceScope&) = delete;
+    DetoursTraceScope& operator=(const DetoursTraceScope&) = delete;
+
+private:
+    const char*    name;
+    const wchar_t* detail;
+    int64_t        start;
+};
+
+/// Write the events recorded so far, can be called multiple times as the file is rewritten.
+void DetoursTraceWrite();
+
+/// Environment variable set by the launcher to the QueryPerformanceCounter value at which it created the game process,
+/// so that process creation appears in the timeline.
+#define DETOURS_TRACE_LAUNCH_TIME_ENV L"DIABLO2_PATCH_TRACE_LAUNCH_TIME"
+#define DETOURS_TRACE_FILE_ENV L"DIABLO2_PATCH_TRACE_FILE"
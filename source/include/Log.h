@@ -1,8 +1,35 @@
-
 #include <Windows.h>
 #include <fmt/format.h>
+
+#ifdef DETOURS_PATCH_PRIVATE
+#include "DetoursLog.h"
+
+// Messages are only formatted on the calling thread, and written asynchronously, see DetoursLogRecord.
+#define DETOURS_LOG_ASYNC(textMember, isWide, fmtstr, ...)                                                             \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        DetoursLogRecord* detoursLogRecord_ = DetoursLogReserve();                                                     \
+        const size_t      detoursLogLength_ =                                                                          \
+            fmt::format_to_n(detoursLogRecord_->textMember, _countof(detoursLogRecord_->textMember),                   \
+                             LOG_PREFIX fmtstr, __VA_ARGS__)                                                           \
+                .size;                                                                                                 \
+        DetoursLogPublish(detoursLogRecord_, detoursLogLength_, isWide);                                               \
+    } while (0)
+#define LOG(fmtstr, ...) DETOURS_LOG_ASYNC(text, false, fmtstr, __VA_ARGS__)
+#define LOGW(fmtstr, ...) DETOURS_LOG_ASYNC(wideText, true, fmtstr, __VA_ARGS__)
+
+#if DETOURS_LOG_LEVEL <= DETOURS_LOG_LEVEL_VERBOSE
+#define LOG_VERBOSE LOG
+#define LOGW_VERBOSE LOGW
+#else
+#define LOG_VERBOSE(fmtstr, ...) ((void)0)
+#define LOGW_VERBOSE(fmtstr, ...) ((void)0)
+#endif
+
+#else
 #define LOG(fmtstr, ...) OutputDebugStringA(fmt::format(LOG_PREFIX fmtstr, __VA_ARGS__).c_str())
 #define LOGW(fmtstr, ...) OutputDebugStringW(fmt::format(LOG_PREFIX fmtstr, __VA_ARGS__).c_str())
+#endif
 
 #define USER_ERROR(fmtstr, ...) MessageBoxA(nullptr, fmt::format(LOG_PREFIX fmtstr, __VA_ARGS__).c_str(), nullptr, MB_OK)
 #define USER_ERRORW(fmtstr, ...) MessageBoxW(nullptr, fmt::format(LOG_PREFIX fmtstr, __VA_ARGS__).c_str(), nullptr, MB_OK)
@@ -1,35 +1,256 @@
 
 #include <DetoursHelpers.h>
+#include <DetoursPEImage.h>
+#include <DetoursPL2Cache.h>
+#include <DetoursPaletteIndexCache.h>
+#include <DetoursPatch.h>
+#include <DetoursShadow.h>
 #include <Windows.h>
 #include <detours.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
 
 #define LOG_PREFIX "(D2CMP.detours):"
 #include "Log.h"
 
+static bool CanReadMemory(const void* address, size_t size)
+{
+    MEMORY_BASIC_INFORMATION memoryInfo;
+    if (!VirtualQuery(address, &memoryInfo, sizeof(memoryInfo)) || memoryInfo.State != MEM_COMMIT) return false;
+    if (memoryInfo.Protect & (PAGE_NOACCESS | PAGE_GUARD)) return false;
+    // The range may straddle regions with different protections.
+    const uintptr_t regionEnd = uintptr_t(memoryInfo.BaseAddress) + memoryInfo.RegionSize;
+    return uintptr_t(address) + size <= regionEnd ||
+           CanReadMemory((const void*)regionEnd, uintptr_t(address) + size - regionEnd);
+}
+
+// Enabled by setting DIABLO2_PATCH_PL2_CACHE_MB, and persisted if DIABLO2_PATCH_PL2_CACHE_FILE is set too.
+static std::unique_ptr<DetoursPL2Cache> pl2Cache;
+
+// Palette with all the tables derived from it, DetoursPL2Cache::pl2Size bytes. Only copied as a whole.
 struct PL2File;
+
+// Fog.dll ordinal 10042, the allocator the D2 modules share, the blocks being freed with Fog.dll ordinal 10043.
+// A hit returns a new block from it, so that the game can write to and free the PL2 as one built by the original
+// function. This assumes CreateD2Palette allocates its result from it too: the cache is only enabled if D2CMP imports
+// it, but the game code using the PL2 files was not checked, this tree has no disassembly of it.
+using FogAllocFunction = void*(__fastcall*)(int nSize, const char* szFile, int nLine, int nUnused);
+static FogAllocFunction fogAlloc;
+
+static void* AllocatePL2(size_t size) { return fogAlloc(int(size), __FILE__, __LINE__, 0); }
+
 static PL2File* __stdcall DetouredCreateD2Palette(BYTE* pPal[256])
 {
-    return GetHookOrdinalInfo<10000>(DetouredCreateD2Palette)
-        .realFunction(pPal);
+    const auto       hook = GetHookOrdinalInfo<10000>(DetouredCreateD2Palette);
+    DetoursHookScope scope(hook.stats);
+    if (!pl2Cache) return hook.realFunction(pPal);
+
+    const uint8_t* palette = reinterpret_cast<const uint8_t*>(pPal);
+    if (void* cachedPL2 = pl2Cache->Find(palette, AllocatePL2)) return static_cast<PL2File*>(cachedPL2);
+
+    PL2File* pl2 = hook.realFunction(pPal);
+    if (pl2) pl2Cache->Store(palette, pl2);
+    return pl2;
+}
+
+struct FogAllocImport
+{
+    HMODULE          hFog;
+    bool             isFogModule = false;
+    FogAllocFunction function    = nullptr;
+};
+
+static BOOL CALLBACK FindFogModuleImport(PVOID pContext, HMODULE hModule, LPCSTR)
+{
+    auto& fogAllocImport       = *static_cast<FogAllocImport*>(pContext);
+    fogAllocImport.isFogModule = hModule && hModule == fogAllocImport.hFog;
+    return TRUE;
+}
+
+static BOOL CALLBACK FindFogAllocImport(PVOID pContext, DWORD nOrdinal, LPCSTR pszFunc, PVOID* ppvFunc)
+{
+    auto& fogAllocImport = *static_cast<FogAllocImport*>(pContext);
+    if (ppvFunc && fogAllocImport.isFogModule && !pszFunc && nOrdinal == 10042)
+        fogAllocImport.function = FogAllocFunction(*ppvFunc);
+    return TRUE;
+}
+
+static void CreatePL2Cache(HMODULE hModule)
+{
+    wchar_t     envValue[MAX_PATH];
+    const DWORD budgetLength = GetEnvironmentVariableW(L"DIABLO2_PATCH_PL2_CACHE_MB", envValue, MAX_PATH);
+    const int   budgetMB     = (budgetLength != 0 && budgetLength < MAX_PATH) ? int(wcstol(envValue, nullptr, 10)) : 0;
+    if (budgetMB <= 0) return;
+    // Read from the imports of D2CMP rather than from Fog.dll, so that the copies come from the allocator it uses.
+    FogAllocImport fogAllocImport{GetModuleHandleW(L"Fog.dll")};
+    DetourEnumerateImportsEx(hModule, &fogAllocImport, FindFogModuleImport, FindFogAllocImport);
+    if (!fogAllocImport.function)
+    {
+        LOG("D2CMP.dll does not import the Fog.dll allocator, the PL2 cache is disabled\n");
+        return;
+    }
+    fogAlloc = fogAllocImport.function;
+
+    const DetoursPEImage image(hModule, DetourGetModuleSize(hModule), DetoursPEImage::Layout::Image);
+    pl2Cache.reset(new DetoursPL2Cache(size_t(budgetMB) << 20,
+                                       {image.GetTimeDateStamp(), image.GetCheckSum(), image.GetSizeOfImage()}));
+    const DWORD pathLength = GetEnvironmentVariableW(L"DIABLO2_PATCH_PL2_CACHE_FILE", envValue, MAX_PATH);
+    if (pathLength != 0 && pathLength < MAX_PATH) pl2Cache->MapFile(envValue);
+}
+
+// The original functions search the whole palette for every color of the shade tables generation loops.
+static DetoursPaletteIndexCache nearestPaletteIndexCache;
+static DetoursPaletteIndexCache farthestPaletteIndexCache;
+static DetoursShadowSite        nearestPaletteIndexShadow{10004};
+static DetoursShadowSite        farthestPaletteIndexShadow{10005};
+
+// D2GetNearestPaletteIndex and D2GetFarthestPaletteIndex read nPaletteSize entries of 4 bytes (blue, green, red and
+// an unused byte), the layout of the palettes D2 keeps in memory and of the base palette of the PL2 files. Both the
+// cache key and the shadow snapshot cover exactly these bytes.
+static size_t PaletteBytes(int nPaletteSize) { return size_t(nPaletteSize) * 4; }
+
+static DetoursShadowMemory DescribePalette(const BYTE* pPalette, int nPaletteSize)
+{
+    const size_t paletteBytes = PaletteBytes(std::max(0, std::min(nPaletteSize, 256)));
+    return {pPalette, CanReadMemory(pPalette, paletteBytes) ? paletteBytes : 0};
 }
 
 BYTE __stdcall DetouredD2GetNearestPaletteIndex(BYTE* pPalette, int nPaletteSize, int nRed, int nGreen, int nBlue)
 {
-    return GetHookOrdinalInfo<10004>(DetouredD2GetNearestPaletteIndex)
-        .realFunction(pPalette, nPaletteSize, nRed, nGreen, nBlue);
+    const auto       hook = GetHookOrdinalInfo<10004>(DetouredD2GetNearestPaletteIndex);
+    DetoursHookScope scope(hook.stats);
+    const auto       getIndex = [&](bool& forwarded, BYTE* palette, int paletteSize, int red, int green, int blue) {
+        const auto computeIndex = [&] {
+            forwarded = true;
+            return hook.realFunction(palette, paletteSize, red, green, blue);
+        };
+        if (paletteSize < 1 || paletteSize > 256) return computeIndex();
+        return nearestPaletteIndexCache.Get(palette, paletteSize, PaletteBytes(paletteSize), red, green, blue,
+                                            computeIndex);
+    };
+    return DetoursShadowCall(
+        nearestPaletteIndexShadow, [&] { return DescribePalette(pPalette, nPaletteSize); }, hook.realFunction,
+        getIndex, pPalette, nPaletteSize, nRed, nGreen, nBlue);
 }
 
 BYTE __stdcall DetouredD2GetFarthestPaletteIndex(BYTE* pPalette, int nPaletteSize, int nRed, int nGreen, int nBlue)
 {
-    return GetHookOrdinalInfo<10005>(DetouredD2GetFarthestPaletteIndex)
-        .realFunction(pPalette, nPaletteSize, nRed, nGreen, nBlue);
+    const auto       hook = GetHookOrdinalInfo<10005>(DetouredD2GetFarthestPaletteIndex);
+    DetoursHookScope scope(hook.stats);
+    const auto       getIndex = [&](bool& forwarded, BYTE* palette, int paletteSize, int red, int green, int blue) {
+        const auto computeIndex = [&] {
+            forwarded = true;
+            return hook.realFunction(palette, paletteSize, red, green, blue);
+        };
+        if (paletteSize < 1 || paletteSize > 256) return computeIndex();
+        return farthestPaletteIndexCache.Get(palette, paletteSize, PaletteBytes(paletteSize), red, green, blue,
+                                             computeIndex);
+    };
+    return DetoursShadowCall(
+        farthestPaletteIndexShadow, [&] { return DescribePalette(pPalette, nPaletteSize); }, hook.realFunction,
+        getIndex, pPalette, nPaletteSize, nRed, nGreen, nBlue);
 }
 
 struct TileHeader;
+
+/**
+ * Direct mapped memo of D2GetTileFlagsType results, queried for every tile during rooms processing.
+ * Entries keep a copy of the start of the tile header, which holds the tile type and orientation, so that they are
+ * invalidated when a tile library is freed or reloaded and a different tile ends up at the same address.
+ * Each entry is guarded by a sequence lock, so that the client and server threads can both use it without locking.
+ */
+class TileFlagsMemo
+{
+public:
+    static const unsigned nbEntries     = 4096;
+    static const unsigned snapshotWords = 8;
+
+    bool Find(const TileHeader* tile, int& flags)
+    {
+        Entry&         entry         = entries[EntryIndex(tile)];
+        const uint32_t sequenceStart = entry.sequence.load(std::memory_order_acquire);
+        if (sequenceStart & 1) return false; // Being written
+        if (entry.tile.load(std::memory_order_relaxed) != tile)
+        {
+            misses.Add();
+            return false;
+        }
+        uint32_t snapshot[snapshotWords];
+        memcpy(snapshot, tile, sizeof(snapshot));
+        bool snapshotMatches = true;
+        for (unsigned i = 0; i < snapshotWords; i++)
+            snapshotMatches &= entry.snapshot[i].load(std::memory_order_relaxed) == snapshot[i];
+        flags = entry.flags.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.sequence.load(std::memory_order_relaxed) != sequenceStart) return false;
+        if (!snapshotMatches)
+        {
+            invalidations.Add();
+            return false;
+        }
+        hits.Add();
+        return true;
+    }
+
+    void Store(const TileHeader* tile, int flags)
+    {
+        Entry&   entry    = entries[EntryIndex(tile)];
+        uint32_t sequence = entry.sequence.load(std::memory_order_relaxed);
+        // Another thread is writing the entry, which is as good as ours.
+        if (sequence & 1) return;
+        if (!entry.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_relaxed)) return;
+        std::atomic_thread_fence(std::memory_order_release);
+        uint32_t snapshot[snapshotWords];
+        memcpy(snapshot, tile, sizeof(snapshot));
+        entry.tile.store(tile, std::memory_order_relaxed);
+        for (unsigned i = 0; i < snapshotWords; i++)
+            entry.snapshot[i].store(snapshot[i], std::memory_order_relaxed);
+        entry.flags.store(flags, std::memory_order_relaxed);
+        entry.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<uint32_t>          sequence{0};
+        std::atomic<const TileHeader*> tile{nullptr};
+        std::atomic<uint32_t>          snapshot[snapshotWords] = {};
+        std::atomic<int>               flags{0};
+    };
+
+    // Tile headers are allocated in arrays, so the low bits of their addresses are the most discriminating.
+    static unsigned EntryIndex(const TileHeader* tile) { return (uintptr_t(tile) >> 4) & (nbEntries - 1); }
+
+    Entry          entries[nbEntries];
+    DetoursCounter hits{"D2GetTileFlagsType memo hits"};
+    DetoursCounter misses{"D2GetTileFlagsType memo misses"};
+    DetoursCounter invalidations{"D2GetTileFlagsType memo invalidations"};
+};
+static TileFlagsMemo tileFlagsMemo;
+
+static DetoursShadowSite tileFlagsShadow{10079};
+
 static int __stdcall DetouredD2GetTileFlagsType(TileHeader* hTile)
 {
-    int flag = GetHookOrdinalInfo<10079>(DetouredD2GetTileFlagsType).realFunction(hTile);
-    return flag;
+    const auto       hook = GetHookOrdinalInfo<10079>(DetouredD2GetTileFlagsType);
+    DetoursHookScope scope(hook.stats);
+    if (!hTile) return hook.realFunction(hTile);
+    const auto getFlags = [&](bool& forwarded, TileHeader* tile) {
+        int flags;
+        if (tileFlagsMemo.Find(tile, flags)) return flags;
+        forwarded = true;
+        flags     = hook.realFunction(tile);
+        tileFlagsMemo.Store(tile, flags);
+        return flags;
+    };
+    // The memo is keyed by the start of the header, which is also what matters to replay the call.
+    const auto describeTile = [&] {
+        const size_t snapshotSize = TileFlagsMemo::snapshotWords * sizeof(uint32_t);
+        return DetoursShadowMemory{hTile, CanReadMemory(hTile, snapshotSize) ? snapshotSize : 0};
+    };
+    return DetoursShadowCall(tileFlagsShadow, describeTile, hook.realFunction, getFlags, hTile);
 }
 
 static DllOrdinalHookTypeless dllOrdinalHooks[]{
@@ -42,23 +263,24 @@ static DllOrdinalHookTypeless dllOrdinalHooks[]{
 bool patchD2CMP(LPCWSTR, void*, HMODULE hModule)
 {
     LOG("Patching D2CMP.dll\n");
-    if (NO_ERROR != DetourTransactionBegin())
+    if (!pl2Cache) CreatePL2Cache(hModule);
+    if (!DetoursPatchTransactionBegin())
     {
         LOG("Failed to start transaction for D2CMP.dll\n");
         return false;
     }
-    DetourUpdateThread(GetCurrentThread());
 
     for (auto& dllOrdinalHook : dllOrdinalHooks)
     {
         dllOrdinalHook.realFunction = GetProcAddress(hModule, (LPCSTR)dllOrdinalHook.ordinal);
         assert(dllOrdinalHook.realFunction);
-        if (NO_ERROR != DetourAttach(&dllOrdinalHook.realFunction, dllOrdinalHook.hookFunction))
+        if (NO_ERROR != DetoursPatchTransactionAttach(&dllOrdinalHook.realFunction, dllOrdinalHook.hookFunction))
         {
             LOGW(L"Failed to patch ordinal {} with {}\n", dllOrdinalHook.ordinal, dllOrdinalHook.hookFunction);
-            exit(-1);
+            DetoursPatchTransactionFail();
+            break;
         }
     }
 
-    return NO_ERROR == DetourTransactionCommit();
+    return DetoursPatchTransactionCommit();
 }
@@ -4,6 +4,8 @@
 #include <detours.h>
 #include <DetoursPatch.h>
 #include <DetoursHelpers.h>
+#include <DetoursPatchManifest.h>
+#include <DetoursTrace.h>
 #include <shlwapi.h>
 
 #define LOG_PREFIX "(D2Common.detours):"
@@ -16,22 +18,18 @@ const wchar_t* patchFolder = (0 != GetEnvironmentVariableW(L"DIABLO2_PATCH", env
 
 bool patchDllWithEmbeddedPatches(LPCWSTR lpLibFileName, LPCWSTR patchLibraryPath, void*, HMODULE hModule)
 {
+    DetoursTraceScope traceScope("Patch dll", patchLibraryPath);
     if (const HMODULE hModulePatch = TrueLoadLibraryW(patchLibraryPath))
     {
         LOGW(L"Patching {} using {}\n", lpLibFileName, patchLibraryPath);
 
-        if (DetourTransactionBegin() != NO_ERROR) return false;
+        // When applying patches in batch, this only joins the batch transaction.
+        if (!DetoursPatchTransactionBegin()) return false;
 
-        DetourUpdateThread(GetCurrentThread());
+        const bool patchSucceeded = DetoursPatchModule(lpLibFileName, hModule, hModulePatch);
+        if (!patchSucceeded) DetoursPatchTransactionFail();
 
-        bool patchSucceeded = false;
-        // We need to keep the addresses that are given to DetourAttach alive until the transaction finishes,
-        // so we store them in a temporary vector
-        std::vector<PVOID> keepAliveOrdinalDetoursAddresses;
-        patchSucceeded = DetoursPatchModule(lpLibFileName, hModule, hModulePatch, keepAliveOrdinalDetoursAddresses);
-
-        if (NO_ERROR != DetourTransactionCommit()) return false;
-        return patchSucceeded;
+        return DetoursPatchTransactionCommit() && patchSucceeded;
     }
     else
     {
@@ -42,6 +40,7 @@ bool patchDllWithEmbeddedPatches(LPCWSTR lpLibFileName, LPCWSTR patchLibraryPath
 
 void D2DetoursRegisterPatchFolder()
 {
+    DetoursTraceScope traceScope("Register patch folder");
     if (!PathFileExistsW(patchFolder))
     {
         USER_ERRORW(L"Could not find directory {}. Aborting.\n", patchFolder);
@@ -64,15 +63,49 @@ void D2DetoursRegisterPatchFolder()
         LOGW(L"Warning: Could not find any dll in {}.\n", patchFolder);
         return;
     }
+
+    // Reading the modules targeted by a patch requires parsing it, so we keep them in a manifest next to the patches.
+    DetoursPatchManifest manifest{fmt::format(L"{}\\D2.Detours.manifest", patchFolder)};
+    manifest.Load();
+    int nbPatchDlls = 0, nbPatchDllsFromManifest = 0;
     do {
+        DetoursTraceScope traceScope("Read patch targets", findData.cFileName);
         LOGW(L"Registering patch for {}.\n", findData.cFileName);
-        DetoursRegisterDllPatch(findData.cFileName, patchFolder, patchDllWithEmbeddedPatches, nullptr);
+        nbPatchDlls++;
+
+        const std::wstring fullDllPath = fmt::format(L"{}\\{}", patchFolder, findData.cFileName);
+        DetoursPatchManifest::FileKey fileKey;
+        if (!DetoursPatchManifest::ComputeFileKey(fullDllPath.c_str(), findData, fileKey))
+        {
+            DetoursRegisterDllPatch(findData.cFileName, patchFolder, patchDllWithEmbeddedPatches, nullptr);
+            continue;
+        }
+
+        if (const DetoursPatchManifest::Entry* cachedEntry = manifest.Find(findData.cFileName, fileKey))
+        {
+            nbPatchDllsFromManifest++;
+            if (cachedEntry->isPatch)
+                DetoursRegisterDllPatchTargets(findData.cFileName, patchFolder, cachedEntry->targetModules,
+                                               patchDllWithEmbeddedPatches, nullptr);
+            continue;
+        }
+
+        DetoursPatchManifest::Entry entry;
+        entry.key     = fileKey;
+        entry.isPatch = DetoursReadDllPatchTargets(fullDllPath.c_str(), entry.targetModules);
+        if (entry.isPatch)
+            DetoursRegisterDllPatchTargets(findData.cFileName, patchFolder, entry.targetModules,
+                                           patchDllWithEmbeddedPatches, nullptr);
+        manifest.Store(findData.cFileName, std::move(entry));
     } while (FindNextFileW(searchHandle, &findData));
 
     FindClose(searchHandle);
 
+    LOGW(L"Registered {} patch dlls, {} of them from the manifest.\n", nbPatchDlls, nbPatchDllsFromManifest);
+    manifest.SaveIfModified();
 
-
+    // Patches may scan the game dlls for signatures, whose results only depend on the game version.
+    DetoursLoadSignatureCache(fmt::format(L"{}\\D2.Detours.signatures", patchFolder).c_str());
 }
 
 
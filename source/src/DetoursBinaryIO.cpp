@@ -0,0 +1,29 @@
+#include "DetoursBinaryIO.h"
+
+#include <Windows.h>
+
+#define LOG_PREFIX "(DetoursBinaryIO):"
+#include "Log.h"
+
+bool DetoursWriteFileAtomically(const std::wstring& path, const std::vector<uint8_t>& content)
+{
+    const std::wstring tmpPath = path + L".tmp";
+    const HANDLE       hFile   = CreateFileW(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                             FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LOGW(L"Failed to create {}\n", tmpPath);
+        return false;
+    }
+    DWORD      written = 0;
+    const bool success = WriteFile(hFile, content.data(), DWORD(content.size()), &written, nullptr) &&
+                         written == content.size();
+    CloseHandle(hFile);
+    if (!success || !MoveFileExW(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        LOGW(L"Failed to write {}\n", path);
+        DeleteFileW(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
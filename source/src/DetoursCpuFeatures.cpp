@@ -0,0 +1,41 @@
+#include "DetoursCpuFeatures.h"
+
+#if DETOURS_X86_SIMD && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+static bool CheckCpuSupportsAVX2()
+{
+#if DETOURS_X86_SIMD && !defined(DETOURS_DISABLE_AVX2)
+    int cpuInfo[4] = {};
+#ifdef _MSC_VER
+    __cpuid(cpuInfo, 1);
+#else
+    __cpuid(1, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+#endif
+    // The OS must also save the YMM registers on context switches
+    const bool osxsave = (cpuInfo[2] & (1 << 27)) != 0;
+    if (!osxsave) return false;
+#ifdef _MSC_VER
+    const unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned xcr0, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+#endif
+    if ((xcr0 & 6) != 6) return false;
+#ifdef _MSC_VER
+    __cpuidex(cpuInfo, 7, 0);
+#else
+    __cpuid_count(7, 0, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+#endif
+    return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+bool DetoursCpuSupportsAVX2()
+{
+    static const bool supportsAVX2 = CheckCpuSupportsAVX2();
+    return supportsAVX2;
+}
@@ -3,6 +3,8 @@
 #include <fmt/format.h>
 #include <shlwapi.h>
 #include "DetoursHelpers.h"
+#include "DetoursPatch.h"
+#include "DetoursTrace.h"
 
 #include "D2CMP.detours.h"
 #include "DetoursAutoPatchDirectory.h"
@@ -42,12 +44,18 @@ BOOL WINAPI DllMain(HINSTANCE hinst, DWORD dwReason, LPVOID reserved)
             {
                 LOG(" Successfully applied detours to LoadLibrary.\n");
 
-                D2DetoursRegisterPatchFolder();
+                {
+                    DetoursTraceScope traceScope("Startup patching");
+                    D2DetoursRegisterPatchFolder();
 
-                // Example of manual patching with D2CMP
-                // DetoursRegisterDllPatch(L"D2CMP.dll", patchD2CMP, nullptr);
-                
-                DetoursApplyPatches();
+                    // Example of manual patching with D2CMP
+                    // DetoursRegisterDllPatch(L"D2CMP.dll", patchD2CMP, nullptr);
+
+                    DetoursApplyPatches();
+                }
+                DetoursPatchTransactionLogStats();
+                DetoursSaveSignatureCache();
+                DetoursTraceWrite();
             }
             else
             {
@@ -65,7 +73,13 @@ BOOL WINAPI DllMain(HINSTANCE hinst, DWORD dwReason, LPVOID reserved)
             if (!DetoursDetachLoadLibraryFunctions()) LOG(" Failed to detach LoadLibrary*\n");
             LONG error = DetourTransactionCommit();
         }
+        // Patches of dlls loaded after startup may have scanned new signatures
+        DetoursSaveSignatureCache();
+        DetoursDumpHookStats();
+        // Also covers the dlls loaded after startup
+        DetoursTraceWrite();
         LOG(" Exiting D2 detours\n");
+        DetoursLogFlush();
     }
     return TRUE;
 }
\ No newline at end of file
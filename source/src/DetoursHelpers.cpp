@@ -1,10 +1,16 @@
 #include "DetoursHelpers.h"
+#include "DetoursMappedFile.h"
+#include "DetoursPEImage.h"
 #include "DetoursPatch.h"
+#include "DetoursSeenModules.h"
+#include "DetoursTrace.h"
 
 #include <Windows.h>
+#include <cwctype>
 #include <detours.h>
 #include <fmt/format.h>
 #include <shlwapi.h>
+#include <unordered_map>
 #include <vector>
 
 #define LOG_PREFIX "(DetoursHelpers):"
@@ -33,27 +39,105 @@ struct DllPatch
 };
 
 static std::vector<DllPatch> dllPatches;
+// Indices (in dllPatches) of the patches for a given module, keyed by the case-folded module name.
+static std::unordered_map<std::wstring, std::vector<size_t>> dllPatchesByModuleName;
+// Number of registered patches that were not applied yet, lets DetoursApplyPatches skip the modules scan entirely.
+static size_t nbPendingDllPatches = 0;
+// Modules already processed by DetoursApplyPatches.
+static DetoursSeenModules seenModules;
+// Modules whose imports were patched. Unlike seenModules, this is not reset when a patch is registered.
+static DetoursSeenModules importsPatchedModules;
 
-static void PatchDLL(LPCWSTR lpLibFileName, HMODULE hModule)
+static bool BatchPatchTransactions()
+{
+    // Committing a single transaction is much cheaper as Detours suspends and flushes once.
+    // Can be disabled to isolate a faulty patch dll more easily.
+    wchar_t     envValue[8];
+    const DWORD envValueLen = GetEnvironmentVariableW(L"DIABLO2_PATCH_BATCH_TRANSACTIONS", envValue, _countof(envValue));
+    return envValueLen == 0 || envValueLen >= _countof(envValue) || wcscmp(envValue, L"0") != 0;
+}
+static bool batchPatchTransactions = BatchPatchTransactions();
+static int batchDepth = 0;
+// Patches applied by the current batch, so that they can be retried if the batch is aborted.
+static std::vector<size_t> batchedPatchIndices;
+
+static std::wstring CaseFoldModuleName(const wchar_t* moduleName)
+{
+    std::wstring foldedName = moduleName;
+    for (wchar_t& c : foldedName)
+        c = towlower(c);
+    return foldedName;
+}
+
+static DWORD GetModuleImageIdentity(HMODULE hModule)
+{
+    // DetourEnumerateModules only returns modules with valid PE headers
+    const auto dosHeader = (const IMAGE_DOS_HEADER*)hModule;
+    const auto ntHeaders = (const IMAGE_NT_HEADERS*)(uintptr_t(hModule) + dosHeader->e_lfanew);
+    return ntHeaders->FileHeader.TimeDateStamp ^ ntHeaders->OptionalHeader.SizeOfImage;
+}
+
+static void RegisterDllPatch(DllPatch&& dllPatch)
+{
+    dllPatchesByModuleName[CaseFoldModuleName(dllPatch.libraryName.c_str())].push_back(dllPatches.size());
+    dllPatches.push_back(std::move(dllPatch));
+    nbPendingDllPatches++;
+    // The new patch may target a module we already processed
+    seenModules.Clear();
+}
+
+// A patch to apply to a loaded module.
+struct PendingDllPatch
+{
+    size_t       patchIndex;
+    std::wstring fileName;
+    HMODULE      hModule;
+};
+
+// Marks the patches of the module as applied and adds them to pendingPatches, so that they are only applied once.
+static void CollectDllPatches(LPCWSTR lpLibFileName, HMODULE hModule, std::vector<PendingDllPatch>& pendingPatches)
 {
     wchar_t fileName[MAX_PATH];
     if (lstrcpynW(fileName, lpLibFileName, _countof(fileName)))
     {
         PathStripPathW(fileName);
-        for (DllPatch& patch : dllPatches)
+        const auto patchesIt = dllPatchesByModuleName.find(CaseFoldModuleName(fileName));
+        if (patchesIt == dllPatchesByModuleName.end()) return;
+
+        for (size_t patchIndex : patchesIt->second)
         {
-            if (!patch.alreadyPatched && 0 == _wcsicmp(fileName, patch.libraryName.c_str()))
+            DllPatch& patch = dllPatches[patchIndex];
+            if (!patch.alreadyPatched)
             {
                 // Do this to avoid recursion, as GetProcAdress can call LoadLibrary
                 patch.alreadyPatched = true;
-
-                if (!patch.patchFunction(fileName, patch.patchLibraryPath.c_str(), patch.userContext, hModule))
-                    LOGW(L"Failed to patch {}\n", patch.libraryName);
+                nbPendingDllPatches--;
+                pendingPatches.push_back({patchIndex, fileName, hModule});
             }
         }
     }
 }
 
+static void ApplyDllPatch(const PendingDllPatch& pendingPatch)
+{
+    if (batchPatchTransactions) batchedPatchIndices.push_back(pendingPatch.patchIndex);
+    // Copy what we need since patching may load libraries, which could register new patches.
+    const DllPatch patch = dllPatches[pendingPatch.patchIndex];
+    if (!patch.patchFunction(pendingPatch.fileName.c_str(), patch.patchLibraryPath.c_str(), patch.userContext,
+                             pendingPatch.hModule))
+        LOGW(L"Failed to patch {}\n", patch.libraryName);
+}
+
+// Lets the patches be collected again, for example to retry them.
+static void RequeueDllPatches(const std::vector<size_t>& patchIndices)
+{
+    for (size_t patchIndex : patchIndices)
+        dllPatches[patchIndex].alreadyPatched = false;
+    nbPendingDllPatches += patchIndices.size();
+    seenModules.Clear();
+    // The import writes of an aborted transaction were discarded too.
+    importsPatchedModules.Clear();
+}
 
 const HMODULE GetDetoursDllModule()
 {
@@ -64,11 +148,9 @@ const HMODULE GetDetoursDllModule()
 }
 const HMODULE gDetoursDllModule = GetDetoursDllModule();
 
-void DetoursRegisterDllPatch(const wchar_t* dllName, const wchar_t* patchFolder, DetoursDllPatchFunction patchFunction,
-                             void* userContext)
+bool DetoursReadDllPatchTargets(const wchar_t* fullDllPath, std::vector<std::wstring>& targetModules)
 {
-    // We need to make sure we load the patch .dll, not the one we want to patch.
-    const std::wstring fullDllPath = fmt::format(L"{}\\{}", patchFolder, dllName);
+    targetModules.clear();
     // To support patching another .dll without specifying a naming convention, we use resource (.rc) files.
     // 
 	// This is because we do not have a way to load a .dll without ensuring we don't load .dlls that should not be
@@ -77,76 +159,166 @@ void DetoursRegisterDllPatch(const wchar_t* dllName, const wchar_t* patchFolder,
     //
     // So we actually need to know the .dll we want to patch so that we don't load the patch too early...
     // We can only rely on either another file (which is not very practical), reading data from the .dll itself, or
-    // embedding this in the patch file name. Most of those solutions are not very practical, and since it is possible
-    // to load a .dll without loading its dependencies nor calling its DllMain (LOAD_LIBRARY_AS_DATAFILE) but still be
-    // able to read its resources, that's what we use... We then unload the patch .dll if it wasn't already loaded, so
-    // that the next LoadLibrary actually loads it correctly.
+    // embedding this in the patch file name. Most of those solutions are not very practical, and since the resources
+    // of a .dll can be read without loading it, that's what we use... The file is only mapped and parsed by
+    // DetoursPEImage, so the Windows loader (and its lock) is never involved.
     //
     // You will need to create a .rc file with the following content:
     // NameOfModulesToPatch 256 { L"TheDLLIWantToPatch.dll;AnotherDllIWantToPatch.dll\0" }
 	// 256 is the resource number we rely on.
-    LPCSTR resourceType = MAKEINTRESOURCE(256);
-    if (HMODULE patchDLL = TrueLoadLibraryExW(fullDllPath.c_str(), NULL, LOAD_LIBRARY_AS_DATAFILE))
+    const uint16_t resourceType = 256;
+    DetoursMappedFile patchFile(fullDllPath);
+    if (patchFile)
     {
+        const DetoursPEImage patchImage(patchFile.data, patchFile.size, DetoursPEImage::Layout::File);
+
 		// Ignore if self.
-        if (gDetoursDllModule == patchDLL)
+        static const DetoursPEImage detoursDllImage(gDetoursDllModule, DetourGetModuleSize(gDetoursDllModule),
+                                                    DetoursPEImage::Layout::Image);
+        if (patchImage.IsValid() && patchImage.GetTimeDateStamp() == detoursDllImage.GetTimeDateStamp() &&
+            patchImage.GetSizeOfImage() == detoursDllImage.GetSizeOfImage())
         {
-            FreeLibrary(patchDLL);
-            return;
-		}
-
-        HRSRC NameOfModulesToPatch = FindResourceA(patchDLL, TEXT("NameOfModuleToPatch"), resourceType); // Backward compat
-        if (!NameOfModulesToPatch)
-            NameOfModulesToPatch = FindResourceA(patchDLL, TEXT("NameOfModulesToPatch"), resourceType);
+            return false;
+        }
 
-        if (NameOfModulesToPatch)
+        const uint8_t* resourceData = nullptr;
+        uint32_t       resourceSize = 0;
+        if (patchImage.FindResource(resourceType, "NameOfModuleToPatch", resourceData, resourceSize) || // Backward compat
+            patchImage.FindResource(resourceType, "NameOfModulesToPatch", resourceData, resourceSize))
         {
-            HGLOBAL  res        = nullptr;
-            wchar_t* dllToPatch = nullptr;
-            if ((res = LoadResource(patchDLL, NameOfModulesToPatch)) &&
-                (dllToPatch = wcsdup((const wchar_t*)(LockResource(res)))))
+            // The resource is an UTF-16 string, which may or may not be null terminated.
+            std::wstring dllToPatch((const wchar_t*)resourceData, resourceSize / sizeof(wchar_t));
+            dllToPatch.resize(wcsnlen(dllToPatch.c_str(), dllToPatch.size()));
+            for (const wchar_t* moduleName = wcstok(&dllToPatch[0], L";"); moduleName != nullptr;
+                 moduleName                = wcstok(0, L";"))
             {
-                for (const wchar_t* moduleName = wcstok(dllToPatch, L";"); moduleName != nullptr;
-                     moduleName                = wcstok(0, L";"))
-                {
-                    LOGW(L"{} will be used to patch {}\n", dllName, moduleName);
-                    dllPatches.push_back(DllPatch{moduleName, fullDllPath, patchFunction, userContext});
-                }
-                free(dllToPatch);
-                FreeLibrary(patchDLL);
-                return;
+                targetModules.emplace_back(moduleName);
             }
+            return true;
         }
-        FreeLibrary(patchDLL);
     }
-    dllPatches.push_back(DllPatch{dllName, fullDllPath, patchFunction, userContext});
+    // Without resource, the patch .dll is expected to have the same name as the .dll it patches.
+    targetModules.emplace_back(PathFindFileNameW(fullDllPath));
+    return true;
+}
+
+void DetoursRegisterDllPatchTargets(const wchar_t* dllName, const wchar_t* patchFolder,
+                                    const std::vector<std::wstring>& targetModules,
+                                    DetoursDllPatchFunction patchFunction, void* userContext)
+{
+    DetoursTraceScope traceScope("Register patch targets", dllName);
+    // We need to make sure we load the patch .dll, not the one we want to patch.
+    const std::wstring fullDllPath = fmt::format(L"{}\\{}", patchFolder, dllName);
+    for (const std::wstring& moduleName : targetModules)
+    {
+        LOGW(L"{} will be used to patch {}\n", dllName, moduleName);
+        RegisterDllPatch(DllPatch{moduleName, fullDllPath, patchFunction, userContext});
+    }
+}
+
+void DetoursRegisterDllPatch(const wchar_t* dllName, const wchar_t* patchFolder, DetoursDllPatchFunction patchFunction,
+                             void* userContext)
+{
+    const std::wstring        fullDllPath = fmt::format(L"{}\\{}", patchFolder, dllName);
+    std::vector<std::wstring> targetModules;
+    if (DetoursReadDllPatchTargets(fullDllPath.c_str(), targetModules))
+        DetoursRegisterDllPatchTargets(dllName, patchFolder, targetModules, patchFunction, userContext);
 }
 
+static void CollectPatchesOfNewModules(std::vector<PendingDllPatch>& pendingPatches);
+
 void DetoursApplyPatches()
 {
-    HMODULE hCurrentModule = nullptr;
-    wchar_t moduleFileName[MAX_PATH];
-    while (nullptr != (hCurrentModule = DetourEnumerateModules(hCurrentModule)))
+    // Once every patch was applied there is nothing left to look for, unless imports of new modules must be patched.
+    if (nbPendingDllPatches == 0 && !DetoursHasImportPatches()) return;
+
+    DetoursTraceScope            traceScope("Apply patches");
+    std::vector<PendingDllPatch> pendingPatches;
+    CollectPatchesOfNewModules(pendingPatches);
+    if (pendingPatches.empty()) return;
+    if (!batchPatchTransactions)
     {
-        WCHAR       szName[MAX_PATH] = {0};
-        const DWORD nRetSize         = GetModuleFileNameW(hCurrentModule, szName, MAX_PATH);
-        if (nRetSize == 0 || nRetSize == MAX_PATH)
+        for (const PendingDllPatch& pendingPatch : pendingPatches)
+            ApplyDllPatch(pendingPatch);
+        return;
+    }
+
+    // Patch dlls are loaded before the transaction is opened, as their DllMain may load libraries or use Detours.
+    // The patch functions loading them again only add a reference. This is not possible for the patches of the
+    // libraries loaded by a patch function, which join the batch transaction.
+    std::vector<HMODULE> patchModules;
+    if (batchDepth == 0)
+    {
+        for (const PendingDllPatch& pendingPatch : pendingPatches)
+        {
+            const std::wstring patchLibraryPath = dllPatches[pendingPatch.patchIndex].patchLibraryPath;
+            if (const HMODULE hPatchModule = TrueLoadLibraryW(patchLibraryPath.c_str()))
+                patchModules.push_back(hPatchModule);
+        }
+    }
+
+    // Patches loading new modules will call us recursively, which joins the current batch.
+    if (DetoursPatchTransactionBegin())
+    {
+        batchDepth++;
+        for (const PendingDllPatch& pendingPatch : pendingPatches)
+            ApplyDllPatch(pendingPatch);
+        batchDepth--;
+        const bool committed = DetoursPatchTransactionCommit();
+        if (batchDepth == 0 && committed) batchedPatchIndices.clear();
+        else if (batchDepth == 0)
         {
-            TRACEW(L"Error occured while getting module {} name\n", (void*)hCurrentModule);
-            continue;
+            // A single faulty patch aborts the whole batch, retry each patch in its own transaction so the others
+            // still apply. The patch dlls stay loaded, and their DllPreLoadHook calls are replayed.
+            LOG("Batched patching failed, retrying each patch separately.\n");
+            RequeueDllPatches(batchedPatchIndices);
+            batchedPatchIndices.clear();
+            batchPatchTransactions = false;
+            DetoursApplyPatches();
+            batchPatchTransactions = true;
         }
-        PatchDLL(szName,hCurrentModule);
     }
+    else
+    {
+        std::vector<size_t> patchIndices;
+        for (const PendingDllPatch& pendingPatch : pendingPatches)
+            patchIndices.push_back(pendingPatch.patchIndex);
+        RequeueDllPatches(patchIndices);
+    }
+
+    for (const HMODULE hPatchModule : patchModules)
+        FreeLibrary(hPatchModule);
+}
+
+static void CollectPatchesOfNewModules(std::vector<PendingDllPatch>& pendingPatches)
+{
+    // Only process modules that were loaded since the last call.
+    seenModules.ForEachNewModule<HMODULE>(
+        [](HMODULE hPreviousModule) { return DetourEnumerateModules(hPreviousModule); },
+        [](HMODULE hModule) { return GetModuleImageIdentity(hModule); },
+        [&](HMODULE hModule) {
+            WCHAR       szName[MAX_PATH] = {0};
+            const DWORD nRetSize         = GetModuleFileNameW(hModule, szName, MAX_PATH);
+            if (nRetSize == 0 || nRetSize == MAX_PATH)
+            {
+                TRACEW(L"Error occured while getting module {} name\n", (void*)hModule);
+                return;
+            }
+            if (importsPatchedModules.Insert(hModule, GetModuleImageIdentity(hModule)))
+                DetoursPatchModuleImports(hModule);
+            CollectDllPatches(szName, hModule, pendingPatches);
+        });
 }
 
 
 template<class CallLoadLibrary>
 HMODULE LoadLibraryPatcher(LPCWSTR lpLibFileName, const CallLoadLibrary& callLoadLibrary)
 {
+    DetoursTraceScope traceScope("LoadLibrary", lpLibFileName);
     const HMODULE hModule = callLoadLibrary();
     // We are forced to check all dlls for patching as the loader does not call LoadLibrary
-    // and we can't trigger LoadLibrary from its notifications
-    // This could easily be optimized at a later point in time if needed.
+    // and we can't trigger LoadLibrary from its notifications.
+    // DetoursApplyPatches only processes the modules it did not see yet, so this stays cheap.
     if(hModule)
         DetoursApplyPatches();
     return hModule;
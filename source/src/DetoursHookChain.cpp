@@ -0,0 +1,70 @@
+#include "DetoursHookChain.h"
+#include "DetoursJumpStub.h"
+
+#include <algorithm>
+#include <atomic>
+
+// Other threads read these pointers while running the chain, the patches reading their next function pointer as a plain
+// variable: they are published with a single aligned store, after a fence making the rest of the chain visible.
+static void PublishPointer(void* volatile* storage, void* value)
+{
+    std::atomic_thread_fence(std::memory_order_release);
+    *storage = value;
+}
+
+DetoursHookChain* DetoursHookChain::Create(void* originalFunction)
+{
+    std::unique_ptr<DetoursHookChain> chain(new DetoursHookChain(originalFunction));
+    chain->stub = DetoursAllocateJumpStub(&chain->firstFunction);
+    return chain->stub ? chain.release() : nullptr;
+}
+
+void DetoursHookChain::SetTrampoline(void* detoursTrampoline)
+{
+    trampoline = detoursTrampoline;
+    if (!HasCommittedHandlers()) PublishPointer(&firstFunction, trampoline);
+}
+
+bool DetoursHookChain::Contains(void* handler) const
+{
+    return std::any_of(handlers.begin(), handlers.end(),
+                       [handler](const std::unique_ptr<Handler>& h) { return h->function == handler; });
+}
+
+bool DetoursHookChain::HasCommittedHandlers() const
+{
+    return std::any_of(handlers.begin(), handlers.end(), [](const std::unique_ptr<Handler>& h) { return !h->pending; });
+}
+
+void DetoursHookChain::AddPending(void* handler, int priority, void** nextFunctionStorage)
+{
+    // Insert after the handlers of the same priority, so that they keep their order.
+    const auto position =
+        std::find_if(handlers.begin(), handlers.end(),
+                     [priority](const std::unique_ptr<Handler>& h) { return h->priority < priority; });
+    Handler* newHandler = new Handler{handler, priority, true, nextFunctionStorage, nullptr};
+    if (!newHandler->nextFunctionStorage) newHandler->nextFunctionStorage = &newHandler->ownNextFunction;
+    handlers.emplace(position, newHandler);
+}
+
+void DetoursHookChain::Commit()
+{
+    // Link from the end of the chain, so that a new handler already points to the rest of the chain when the pointer
+    // making it reachable is written.
+    void* nextFunction = trampoline;
+    for (auto it = handlers.rbegin(); it != handlers.rend(); ++it)
+    {
+        Handler& handler = **it;
+        handler.pending  = false;
+        if (*handler.nextFunctionStorage != nextFunction) PublishPointer(handler.nextFunctionStorage, nextFunction);
+        nextFunction = handler.function;
+    }
+    PublishPointer(&firstFunction, nextFunction);
+}
+
+void DetoursHookChain::Abort()
+{
+    handlers.erase(std::remove_if(handlers.begin(), handlers.end(),
+                                  [](const std::unique_ptr<Handler>& h) { return h->pending; }),
+                   handlers.end());
+}
@@ -0,0 +1,64 @@
+#include "DetoursHookStats.h"
+#include "DetoursShadow.h"
+
+#include <algorithm>
+#include <vector>
+
+#define LOG_PREFIX "(DetoursHookStats):"
+#include "Log.h"
+
+void DetoursDumpHookStatsImpl()
+{
+    bool hasCounters = false;
+    DetoursCounter* const firstCounter = DetoursCounter::List().load(std::memory_order_acquire);
+    for (DetoursCounter* counter = firstCounter; counter; counter = counter->next)
+    {
+        if (!hasCounters) LOG("Counters:\n");
+        hasCounters = true;
+        LOG(" {}: {}\n", counter->name, counter->Get());
+    }
+    DetoursDumpShadowStats();
+
+    struct HookSummary
+    {
+        int      ordinal;
+        uint64_t calls;
+        uint64_t totalCycles;
+        uint64_t histogram[DetoursHookStats::nbHistogramBuckets];
+    };
+    std::vector<HookSummary> summaries;
+    DetoursHookStats* const firstStats = DetoursHookStats::List().load(std::memory_order_acquire);
+    for (DetoursHookStats* stats = firstStats; stats; stats = stats->next)
+    {
+        HookSummary summary{stats->ordinal, 0, 0, {}};
+        for (const DetoursHookStats::ThreadSlot& slot : stats->slots)
+        {
+            summary.calls += slot.calls.load(std::memory_order_relaxed);
+            summary.totalCycles += slot.totalCycles.load(std::memory_order_relaxed);
+            for (unsigned bucket = 0; bucket < DetoursHookStats::nbHistogramBuckets; bucket++)
+                summary.histogram[bucket] += slot.histogram[bucket].load(std::memory_order_relaxed);
+        }
+        if (summary.calls) summaries.push_back(summary);
+    }
+    if (summaries.empty()) return;
+
+    std::sort(summaries.begin(), summaries.end(),
+              [](const HookSummary& lhs, const HookSummary& rhs) { return lhs.calls > rhs.calls; });
+    LOG("Hooks stats, latencies are in cycles:\n");
+    for (const HookSummary& summary : summaries)
+    {
+        // Percentiles are given as the upper bound of their bucket
+        unsigned p50Bucket = 0, p99Bucket = 0;
+        uint64_t cumulatedCalls = 0;
+        for (unsigned bucket = 0; bucket < DetoursHookStats::nbHistogramBuckets; bucket++)
+        {
+            if (cumulatedCalls * 2 < summary.calls) p50Bucket = bucket;
+            if (cumulatedCalls * 100 < summary.calls * 99) p99Bucket = bucket;
+            cumulatedCalls += summary.histogram[bucket];
+        }
+        LOG(" Ordinal {}: {} calls, {} cycles on average, p50 < {}, p99 < {}\n", summary.ordinal, summary.calls,
+            summary.totalCycles / summary.calls, uint64_t(2) << p50Bucket, uint64_t(2) << p99Bucket);
+    }
+}
+
+void __cdecl DetoursDumpHookStats() { DetoursDumpHookStatsImpl(); }
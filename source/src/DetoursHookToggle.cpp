@@ -0,0 +1,107 @@
+#include "DetoursHookToggle.h"
+#include "DetoursFlatPointerMap.h"
+#include "DetoursJumpStub.h"
+
+#include <Windows.h>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#define LOG_PREFIX "(DetoursHookToggle):"
+#include "Log.h"
+
+static_assert(sizeof(std::atomic<uint8_t>) == 1, "The stub compares the flag as a byte");
+
+DetoursHookToggle* DetoursHookToggle::Create(void* originalFunction, void* patchFunction)
+{
+#if defined(_M_IX86) || defined(__i386__)
+    std::unique_ptr<DetoursHookToggle> toggle(new DetoursHookToggle(originalFunction, patchFunction));
+    const void* const enabledAddress       = &toggle->enabled;
+    const void* const patchFunctionAddress = &toggle->patchFunction;
+    const void* const trampolineAddress    = &toggle->trampoline;
+
+    // Only the flags are modified, no calling convention expects them to be preserved.
+    uint8_t code[21] = {
+        0x80, 0x3D, 0, 0, 0, 0, 0x00, // cmp byte ptr [enabled], 0
+        0x74, 0x06,                   // je  disabled
+        0xFF, 0x25, 0, 0, 0, 0,       // jmp dword ptr [patchFunction]
+        0xFF, 0x25, 0, 0, 0, 0,       // disabled: jmp dword ptr [trampoline]
+    };
+    memcpy(code + 2, &enabledAddress, sizeof(enabledAddress));
+    memcpy(code + 11, &patchFunctionAddress, sizeof(patchFunctionAddress));
+    memcpy(code + 17, &trampolineAddress, sizeof(trampolineAddress));
+    toggle->stub = DetoursAllocateStub(code, sizeof(code));
+    return toggle->stub ? toggle.release() : nullptr;
+#else
+    (void)originalFunction;
+    (void)patchFunction;
+    LOGW(L"Hook toggles are only supported on x86.\n");
+    return nullptr;
+#endif
+}
+
+static bool UseHookToggles()
+{
+    wchar_t     envValue[8];
+    const DWORD envValueLen = GetEnvironmentVariableW(L"DIABLO2_PATCH_HOOK_TOGGLES", envValue, _countof(envValue));
+    return envValueLen != 0 && envValueLen < _countof(envValue) && wcscmp(envValue, L"1") == 0;
+}
+
+struct HookToggles
+{
+    const bool enabled = UseHookToggles();
+    // Original function => DetoursHookToggle
+    DetoursFlatPointerMap<1 << 14>                  toggles;
+    // Never freed, as the callers may still run the stubs.
+    std::vector<std::unique_ptr<DetoursHookToggle>> storage;
+    // Original functions in insertion order, for transaction rollbacks.
+    std::vector<void*> journal;
+};
+static HookToggles gHookToggles;
+
+bool DetoursUseHookToggles() { return gHookToggles.enabled; }
+
+bool DetoursRegisterHookToggle(DetoursHookToggle* toggle)
+{
+    gHookToggles.storage.emplace_back(toggle);
+    bool inserted = false;
+    if (!gHookToggles.toggles.Insert(toggle->GetOriginalFunction(), toggle, inserted))
+    {
+        LOGW(L"Too many toggleable hooks, could not register the hook of {}\n", toggle->GetOriginalFunction());
+        return false;
+    }
+    if (!inserted)
+    {
+        LOGW(L"{} already has a toggleable hook\n", toggle->GetOriginalFunction());
+        return false;
+    }
+    gHookToggles.journal.push_back(toggle->GetOriginalFunction());
+    return true;
+}
+
+size_t DetoursHookTogglesCheckpoint() { return gHookToggles.journal.size(); }
+
+void DetoursHookTogglesRollback(size_t checkpoint)
+{
+    while (gHookToggles.journal.size() > checkpoint)
+    {
+        gHookToggles.toggles.Erase(gHookToggles.journal.back());
+        gHookToggles.journal.pop_back();
+    }
+}
+
+bool __cdecl DetoursSetHookEnabled(void* originalFunction, bool enabled)
+{
+    const auto* entry = originalFunction ? gHookToggles.toggles.Find(originalFunction) : nullptr;
+    if (!entry || !entry->value) return false;
+    static_cast<DetoursHookToggle*>(entry->value)->SetEnabled(enabled);
+    return true;
+}
+
+bool __cdecl DetoursSetOrdinalHookEnabled(const wchar_t* moduleName, int ordinal, bool enabled)
+{
+    const HMODULE hModule = GetModuleHandleW(moduleName);
+    if (!hModule || ordinal <= 0 || ordinal > 0xFFFF) return false;
+    // Aliased ordinals patched through thunks are looked up by their thunk, which GetProcAddress returns.
+    return DetoursSetHookEnabled((void*)GetProcAddress(hModule, (LPCSTR)uintptr_t(ordinal)), enabled);
+}
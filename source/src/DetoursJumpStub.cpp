@@ -0,0 +1,54 @@
+#include "DetoursJumpStub.h"
+
+#include <Windows.h>
+#include <cstring>
+
+#define LOG_PREFIX "(DetoursJumpStub):"
+#include "Log.h"
+
+static const size_t stubAlignment = 16;
+
+void* DetoursAllocateStub(const uint8_t* code, size_t codeSize)
+{
+    static uint8_t* page          = nullptr;
+    static size_t   pageSize      = 0;
+    static size_t   usedPageBytes = 0;
+
+    const size_t stubSize = (codeSize + stubAlignment - 1) & ~(stubAlignment - 1);
+    if (!page || usedPageBytes + stubSize > pageSize)
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        if (stubSize > systemInfo.dwPageSize) return nullptr;
+        pageSize      = systemInfo.dwPageSize;
+        usedPageBytes = 0;
+        page          = (uint8_t*)VirtualAlloc(nullptr, pageSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ);
+        if (!page) return nullptr;
+    }
+
+    uint8_t* const stub = page + usedPageBytes;
+    DWORD          oldProtect;
+    // The page stays executable, other stubs in it may be running.
+    if (!VirtualProtect(stub, stubSize, PAGE_EXECUTE_READWRITE, &oldProtect)) return nullptr;
+    memcpy(stub, code, codeSize);
+    memset(stub + codeSize, 0xCC, stubSize - codeSize);
+    VirtualProtect(stub, stubSize, oldProtect, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), stub, stubSize);
+    usedPageBytes += stubSize;
+    return stub;
+}
+
+void* DetoursAllocateJumpStub(void* const volatile* jumpTarget)
+{
+#if defined(_M_IX86) || defined(__i386__)
+    // jmp dword ptr [jumpTarget], which preserves every register and the stack whatever the calling convention is.
+    // Detours only follows such jumps when they go through an import table, so it will not skip the stub.
+    uint8_t code[6] = {0xFF, 0x25};
+    memcpy(code + 2, &jumpTarget, sizeof(jumpTarget));
+    return DetoursAllocateStub(code, sizeof(code));
+#else
+    (void)jumpTarget;
+    LOGW(L"Jump stubs are only supported on x86.\n");
+    return nullptr;
+#endif
+}
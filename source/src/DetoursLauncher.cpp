@@ -2,6 +2,7 @@
 #include <detours.h>
 #include <PathCch.h>
 #include <DetoursPatch.h>
+#include <DetoursTrace.h>
 
 #define LOG_PREFIX "(D2.DetoursLauncher):"
 #include "Log.h"
@@ -183,6 +184,15 @@ int wmain(int argc, wchar_t* argv[])
     PROCESS_INFORMATION pi;
     ZeroMemory(&pi, sizeof(pi));
     const DWORD dwFlags = CREATE_DEFAULT_ERROR_MODE | CREATE_SUSPENDED;
+
+    // Let the startup timeline include the process creation, the child inherits our environment.
+    // QueryPerformanceCounter is consistent across processes of the same system.
+    if (0 != GetEnvironmentVariableW(DETOURS_TRACE_FILE_ENV, nullptr, 0))
+    {
+        LARGE_INTEGER launchTime;
+        QueryPerformanceCounter(&launchTime);
+        SetEnvironmentVariableW(DETOURS_TRACE_LAUNCH_TIME_ENV, std::to_wstring(launchTime.QuadPart).c_str());
+    }
     if (DetourCreateProcessWithDllExW(appName, D2ProcessCommandLine,
         NULL, NULL, 
         TRUE, dwFlags, 
@@ -0,0 +1,167 @@
+#include "DetoursLog.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+
+// Bounded multi-producer queue, where each cell sequence tells whether it is free to be written or ready to be read.
+// Producers never lock, only the single consumer that writes the messages does.
+// Sequences are stored relative to the cell index so that a zero initialized queue is valid, as messages may be logged
+// by static initializers of other files before this one is initialized.
+namespace
+{
+struct LogCell
+{
+    std::atomic<size_t> relativeSequence;
+    DetoursLogRecord    record;
+};
+
+const size_t nbLogCells = 1024; // Must be a power of 2
+
+struct LogQueue
+{
+    LogCell             cells[nbLogCells];
+    std::atomic<size_t> enqueuePosition;
+    // Only modified while holding consumerLock
+    size_t              dequeuePosition;
+    std::atomic_flag    consumerLock;
+    std::atomic<bool>   consumerWaiting;
+    HANDLE              wakeConsumerEvent;
+    // Messages are written with OutputDebugString if there is none
+    HANDLE              outputFile;
+};
+LogQueue logQueue;
+
+// A cell can be written by the producer at `position` once its sequence is `position`, and read once it is `position + 1`
+size_t LoadSequence(const LogCell& cell, size_t position)
+{
+    return cell.relativeSequence.load(std::memory_order_acquire) + (position & (nbLogCells - 1));
+}
+void StoreSequence(LogCell& cell, size_t position, size_t sequence)
+{
+    cell.relativeSequence.store(sequence - (position & (nbLogCells - 1)), std::memory_order_release);
+}
+} // namespace
+
+static void WriteRecord(const DetoursLogRecord& record)
+{
+    if (!logQueue.outputFile)
+    {
+        if (record.isWide) OutputDebugStringW(record.wideText);
+        else OutputDebugStringA(record.text);
+        return;
+    }
+
+    DWORD written;
+    if (record.isWide)
+    {
+        char      utf8Text[DetoursLogRecord::maxBytes * 2];
+        const int utf8Length = WideCharToMultiByte(CP_UTF8, 0, record.wideText, int(record.length), utf8Text,
+                                                   int(sizeof(utf8Text)), nullptr, nullptr);
+        WriteFile(logQueue.outputFile, utf8Text, DWORD(utf8Length), &written, nullptr);
+    }
+    else
+    {
+        WriteFile(logQueue.outputFile, record.text, record.length, &written, nullptr);
+    }
+}
+
+// Returns false if another thread is already writing the messages.
+static bool TryWriteQueuedRecords()
+{
+    if (logQueue.consumerLock.test_and_set(std::memory_order_acquire)) return false;
+    for (;;)
+    {
+        const size_t position = logQueue.dequeuePosition;
+        LogCell&     cell     = logQueue.cells[position & (nbLogCells - 1)];
+        // Stop at the first record not published yet to keep the messages in order
+        if (LoadSequence(cell, position) != position + 1) break;
+        WriteRecord(cell.record);
+        StoreSequence(cell, position, position + nbLogCells);
+        logQueue.dequeuePosition = position + 1;
+    }
+    logQueue.consumerLock.clear(std::memory_order_release);
+    return true;
+}
+
+static DWORD WINAPI LogThread(LPVOID)
+{
+    for (;;)
+    {
+        TryWriteQueuedRecords();
+        logQueue.consumerWaiting.store(true, std::memory_order_seq_cst);
+        // The timeout covers the messages published between the last write and the flag being set
+        WaitForSingleObject(logQueue.wakeConsumerEvent, 50);
+        logQueue.consumerWaiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+static bool StartLogThread()
+{
+    wchar_t     logFilePath[MAX_PATH];
+    const DWORD logFilePathLen = GetEnvironmentVariableW(L"DIABLO2_PATCH_LOG_FILE", logFilePath, MAX_PATH);
+    if (logFilePathLen != 0 && logFilePathLen < MAX_PATH)
+    {
+        const HANDLE hFile = CreateFileW(logFilePath, FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                                         FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile != INVALID_HANDLE_VALUE) logQueue.outputFile = hFile;
+    }
+    logQueue.wakeConsumerEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    // This will only start running once the loader lock is released, until then producers write the messages.
+    const HANDLE hThread = logQueue.wakeConsumerEvent ? CreateThread(nullptr, 0, LogThread, nullptr, 0, nullptr) : nullptr;
+    if (hThread) CloseHandle(hThread);
+    return hThread != nullptr;
+}
+static const bool logThreadStarted = StartLogThread();
+
+DetoursLogRecord* DetoursLogReserve()
+{
+    size_t position = logQueue.enqueuePosition.load(std::memory_order_relaxed);
+    for (int nbFullQueueTries = 0;;)
+    {
+        LogCell&        cell     = logQueue.cells[position & (nbLogCells - 1)];
+        const size_t    sequence = LoadSequence(cell, position);
+        const ptrdiff_t diff     = ptrdiff_t(sequence) - ptrdiff_t(position);
+        if (diff == 0)
+        {
+            if (logQueue.enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.record.position = position;
+                return &cell.record;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The queue is full, write the messages ourselves unless another thread is already doing it.
+            if (!TryWriteQueuedRecords()) Sleep(nbFullQueueTries++ < 16 ? 0 : 1);
+            position = logQueue.enqueuePosition.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            position = logQueue.enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void DetoursLogPublish(DetoursLogRecord* record, size_t length, bool isWide)
+{
+    // Truncated messages still need their terminator for OutputDebugString
+    const size_t capacity = isWide ? _countof(record->wideText) : _countof(record->text);
+    length                = std::min(length, capacity - 1);
+    if (isWide) record->wideText[length] = L'\0';
+    else record->text[length] = '\0';
+    record->length = uint32_t(length);
+    record->isWide = isWide;
+
+    LogCell& cell = logQueue.cells[record->position & (nbLogCells - 1)];
+    StoreSequence(cell, record->position, record->position + 1);
+    if (logQueue.consumerWaiting.load(std::memory_order_seq_cst)) SetEvent(logQueue.wakeConsumerEvent);
+}
+
+void DetoursLogFlush()
+{
+    // The logging thread may have been terminated while writing if the process is exiting, so do not wait forever.
+    for (int tries = 0; !TryWriteQueuedRecords() && tries < 100; tries++)
+        Sleep(1);
+    if (logQueue.outputFile) FlushFileBuffers(logQueue.outputFile);
+}
@@ -0,0 +1,27 @@
+#include "DetoursMappedFile.h"
+
+DetoursMappedFile::DetoursMappedFile(const wchar_t* path)
+{
+    const HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                     FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER fileSize;
+    // Empty files can not be mapped
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= SIZE_MAX)
+    {
+        if (const HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr))
+        {
+            data = static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+            if (data) size = size_t(fileSize.QuadPart);
+            // The view keeps a reference to the mapping
+            CloseHandle(hMapping);
+        }
+    }
+    CloseHandle(hFile);
+}
+
+DetoursMappedFile::~DetoursMappedFile()
+{
+    if (data) UnmapViewOfFile(data);
+}
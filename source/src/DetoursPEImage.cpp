@@ -0,0 +1,224 @@
+#include "DetoursPEImage.h"
+
+#include <cstring>
+
+// Offsets of the fields we use in the PE32 structures.
+// Reading through memcpy avoids any alignment or aliasing issue with malformed files.
+namespace
+{
+const uint16_t dosSignature           = 0x5A4D;     // MZ
+const uint32_t ntSignature            = 0x00004550; // PE\0\0
+const uint16_t optionalHeaderMagicPE32 = 0x10B;
+
+const size_t dosHeaderLfanewOffset   = 0x3C;
+const size_t fileHeaderOffset        = 4; // After the signature
+const size_t fileHeaderSize          = 20;
+const size_t optionalHeaderOffset    = fileHeaderOffset + fileHeaderSize;
+const size_t optionalHeaderDataDirectoriesOffset = 96;
+const size_t sectionHeaderSize       = 40;
+
+const uint32_t resourceDirectorySize       = 16;
+const uint32_t resourceDirectoryEntrySize  = 8;
+const uint32_t resourceDataEntrySize       = 16;
+const uint32_t resourceHighBit             = 0x80000000;
+
+const uint32_t exportDirectorySize         = 40;
+
+const uint32_t dataDirectoryExport   = 0;
+const uint32_t dataDirectoryResource = 2;
+
+template<class T>
+T ReadAt(const uint8_t* data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+char AsciiToUpper(char c) { return (c >= 'a' && c <= 'z') ? char(c - 'a' + 'A') : c; }
+} // namespace
+
+DetoursPEImage::DetoursPEImage(const void* base, size_t size, Layout layout)
+    : base(static_cast<const uint8_t*>(base)), size(size), layout(layout)
+{
+    if (!base || size < dosHeaderLfanewOffset + sizeof(uint32_t)) return;
+    if (ReadAt<uint16_t>(this->base) != dosSignature) return;
+
+    const uint32_t ntOffset = ReadAt<uint32_t>(this->base + dosHeaderLfanewOffset);
+    if (ntOffset == 0 || ntOffset > size || size - ntOffset < optionalHeaderOffset + optionalHeaderDataDirectoriesOffset)
+        return;
+    const uint8_t* ntHeaders = this->base + ntOffset;
+    if (ReadAt<uint32_t>(ntHeaders) != ntSignature) return;
+
+    const uint16_t sizeOfOptionalHeader = ReadAt<uint16_t>(ntHeaders + fileHeaderOffset + 16);
+    if (ReadAt<uint16_t>(ntHeaders + optionalHeaderOffset) != optionalHeaderMagicPE32 ||
+        sizeOfOptionalHeader < optionalHeaderDataDirectoriesOffset)
+        return;
+
+    const uint16_t sectionsCount = ReadAt<uint16_t>(ntHeaders + fileHeaderOffset + 2);
+    const size_t   sectionsStart = size_t(ntOffset) + optionalHeaderOffset + sizeOfOptionalHeader;
+    if (sectionsStart > size || (size - sectionsStart) / sectionHeaderSize < sectionsCount) return;
+
+    ntHeadersOffset = ntOffset;
+    sectionsOffset  = uint32_t(sectionsStart);
+    nbSections      = sectionsCount;
+    sizeOfHeaders   = ReadAt<uint32_t>(ntHeaders + optionalHeaderOffset + 60);
+}
+
+uint32_t DetoursPEImage::GetTimeDateStamp() const
+{
+    return IsValid() ? ReadAt<uint32_t>(base + ntHeadersOffset + fileHeaderOffset + 4) : 0;
+}
+
+uint32_t DetoursPEImage::GetCheckSum() const
+{
+    return IsValid() ? ReadAt<uint32_t>(base + ntHeadersOffset + optionalHeaderOffset + 64) : 0;
+}
+
+uint32_t DetoursPEImage::GetSizeOfImage() const
+{
+    return IsValid() ? ReadAt<uint32_t>(base + ntHeadersOffset + optionalHeaderOffset + 56) : 0;
+}
+
+bool DetoursPEImage::GetSection(uint16_t sectionIndex, Section& section) const
+{
+    if (sectionIndex >= nbSections) return false;
+    const uint8_t* header = base + sectionsOffset + size_t(sectionIndex) * sectionHeaderSize;
+    memcpy(section.name, header, sizeof(section.name));
+    section.virtualSize     = ReadAt<uint32_t>(header + 8);
+    section.virtualAddress  = ReadAt<uint32_t>(header + 12);
+    section.rawDataSize     = ReadAt<uint32_t>(header + 16);
+    section.rawDataOffset   = ReadAt<uint32_t>(header + 20);
+    section.characteristics = ReadAt<uint32_t>(header + 36);
+    return true;
+}
+
+const uint8_t* DetoursPEImage::RvaToPointer(uint32_t rva, size_t byteCount) const
+{
+    if (!IsValid()) return nullptr;
+    if (layout == Layout::Image || rva < sizeOfHeaders)
+    {
+        if (rva > size || size - rva < byteCount) return nullptr;
+        return base + rva;
+    }
+    for (uint16_t sectionIndex = 0; sectionIndex < nbSections; sectionIndex++)
+    {
+        Section section;
+        GetSection(sectionIndex, section);
+        const uint32_t offsetInSection = rva - section.virtualAddress;
+        if (rva < section.virtualAddress || offsetInSection >= section.rawDataSize) continue;
+        // Data past the raw data (but still in the virtual size) would be zeroes, we do not expose it.
+        if (section.rawDataSize - offsetInSection < byteCount) return nullptr;
+        const size_t fileOffset = size_t(section.rawDataOffset) + offsetInSection;
+        if (fileOffset > size || size - fileOffset < byteCount) return nullptr;
+        return base + fileOffset;
+    }
+    return nullptr;
+}
+
+bool DetoursPEImage::GetDataDirectory(uint32_t directoryIndex, uint32_t& rva, uint32_t& directorySize) const
+{
+    if (!IsValid()) return false;
+    const uint8_t* optionalHeader = base + ntHeadersOffset + optionalHeaderOffset;
+    const uint32_t nbDirectories  = ReadAt<uint32_t>(optionalHeader + optionalHeaderDataDirectoriesOffset - 4);
+    const uint16_t sizeOfOptionalHeader = ReadAt<uint16_t>(base + ntHeadersOffset + fileHeaderOffset + 16);
+    const size_t   directoryOffset = optionalHeaderDataDirectoriesOffset + size_t(directoryIndex) * 8;
+    if (directoryIndex >= nbDirectories || directoryOffset + 8 > sizeOfOptionalHeader) return false;
+    rva           = ReadAt<uint32_t>(optionalHeader + directoryOffset);
+    directorySize = ReadAt<uint32_t>(optionalHeader + directoryOffset + 4);
+    return rva != 0 && directorySize != 0;
+}
+
+bool DetoursPEImage::GetExportDirectory(ExportDirectory& exportDirectory) const
+{
+    uint32_t directoryRva, directorySize;
+    if (!GetDataDirectory(dataDirectoryExport, directoryRva, directorySize)) return false;
+    const uint8_t* directory = RvaToPointer(directoryRva, exportDirectorySize);
+    if (!directory) return false;
+
+    exportDirectory.ordinalBase   = ReadAt<uint32_t>(directory + 16);
+    exportDirectory.nbFunctions   = ReadAt<uint32_t>(directory + 20);
+    exportDirectory.functionsRva  = ReadAt<uint32_t>(directory + 28);
+    exportDirectory.directoryRva  = directoryRva;
+    exportDirectory.directorySize = directorySize;
+    // Make sure the whole functions table is readable so that lookups only need to check the ordinal
+    return exportDirectory.nbFunctions <= size / sizeof(uint32_t) &&
+           RvaToPointer(exportDirectory.functionsRva, exportDirectory.nbFunctions * sizeof(uint32_t)) != nullptr;
+}
+
+uint32_t DetoursPEImage::GetExportRva(const ExportDirectory& exportDirectory, uint32_t ordinal) const
+{
+    const uint32_t functionIndex = ordinal - exportDirectory.ordinalBase;
+    if (ordinal < exportDirectory.ordinalBase || functionIndex >= exportDirectory.nbFunctions) return 0;
+    const uint8_t* functions = RvaToPointer(exportDirectory.functionsRva, exportDirectory.nbFunctions * sizeof(uint32_t));
+    return functions ? ReadAt<uint32_t>(functions + functionIndex * sizeof(uint32_t)) : 0;
+}
+
+// Returns the OffsetToData of the matching entry of the directory, 0 if not found.
+uint32_t DetoursPEImage::FindResourceEntry(uint32_t resourceRva, uint32_t resourceSize, uint32_t directoryOffset,
+                                           uint16_t id, const char* name) const
+{
+    if (directoryOffset >= resourceSize) return 0;
+    const uint8_t* directory = RvaToPointer(resourceRva + directoryOffset, resourceDirectorySize);
+    if (!directory) return 0;
+    const uint16_t nbNamedEntries = ReadAt<uint16_t>(directory + 12);
+    const uint16_t nbIdEntries    = ReadAt<uint16_t>(directory + 14);
+    const uint32_t nbEntries      = uint32_t(nbNamedEntries) + nbIdEntries;
+    const uint8_t* entries        = RvaToPointer(resourceRva + directoryOffset + resourceDirectorySize,
+                                                 size_t(nbEntries) * resourceDirectoryEntrySize);
+    if (!entries) return 0;
+
+    for (uint32_t entryIndex = 0; entryIndex < nbEntries; entryIndex++)
+    {
+        const uint8_t* entry        = entries + entryIndex * resourceDirectoryEntrySize;
+        const uint32_t entryName    = ReadAt<uint32_t>(entry);
+        const uint32_t offsetToData = ReadAt<uint32_t>(entry + 4);
+        const bool     isNamedEntry = (entryName & resourceHighBit) != 0;
+        if (!name)
+        {
+            // Any entry matches when looking for the first one
+            if (id == 0 || (!isNamedEntry && entryName == id)) return offsetToData;
+            continue;
+        }
+        if (!isNamedEntry) continue;
+
+        // Named entries point to a length prefixed UTF-16 string, which the resource compiler stores in upper case.
+        const uint32_t stringOffset = entryName & ~resourceHighBit;
+        const uint8_t* nameLength   = RvaToPointer(resourceRva + stringOffset, sizeof(uint16_t));
+        if (!nameLength) continue;
+        const uint16_t length       = ReadAt<uint16_t>(nameLength);
+        const uint8_t* nameString   = RvaToPointer(resourceRva + stringOffset + sizeof(uint16_t),
+                                                   size_t(length) * sizeof(uint16_t));
+        if (!nameString || strlen(name) != length) continue;
+        uint16_t charIndex = 0;
+        for (; charIndex < length; charIndex++)
+        {
+            const uint16_t c = ReadAt<uint16_t>(nameString + charIndex * sizeof(uint16_t));
+            if (c > 0x7F || AsciiToUpper(char(c)) != AsciiToUpper(name[charIndex])) break;
+        }
+        if (charIndex == length) return offsetToData;
+    }
+    return 0;
+}
+
+bool DetoursPEImage::FindResource(uint16_t typeId, const char* name, const uint8_t*& data, uint32_t& dataSize) const
+{
+    uint32_t resourceRva, resourceSize;
+    if (!GetDataDirectory(dataDirectoryResource, resourceRva, resourceSize)) return false;
+
+    // Resources are stored as a 3 levels tree: type, name and language.
+    const uint32_t typeEntry = FindResourceEntry(resourceRva, resourceSize, 0, typeId, nullptr);
+    if (!(typeEntry & resourceHighBit)) return false;
+    const uint32_t nameEntry = FindResourceEntry(resourceRva, resourceSize, typeEntry & ~resourceHighBit, 0, name);
+    if (!(nameEntry & resourceHighBit)) return false;
+    const uint32_t languageEntry = FindResourceEntry(resourceRva, resourceSize, nameEntry & ~resourceHighBit, 0, nullptr);
+    if (languageEntry == 0 || (languageEntry & resourceHighBit) || languageEntry >= resourceSize) return false;
+
+    const uint8_t* dataEntry = RvaToPointer(resourceRva + languageEntry, resourceDataEntrySize);
+    if (!dataEntry) return false;
+    // Unlike the directory offsets, the data offset is an RVA
+    const uint32_t dataRva = ReadAt<uint32_t>(dataEntry);
+    dataSize               = ReadAt<uint32_t>(dataEntry + 4);
+    data                   = RvaToPointer(dataRva, dataSize);
+    return data != nullptr;
+}
@@ -0,0 +1,158 @@
+#include "DetoursPL2Cache.h"
+#include "DetoursHash.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstring>
+
+#define LOG_PREFIX "(DetoursPL2Cache):"
+#include "Log.h"
+
+static const uint32_t pl2CacheMagic   = 'D2PL';
+static const uint32_t pl2CacheVersion = 2;
+
+DetoursPL2Cache::DetoursPL2Cache(size_t budget, BuilderKey builder) : memoryBudget(budget), builderKey(builder) {}
+
+DetoursPL2Cache::~DetoursPL2Cache()
+{
+    for (const Entry& entry : entries)
+        ReleaseEntry(entry);
+}
+
+bool DetoursPL2Cache::MapFile(const std::wstring& filePath)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    path        = filePath;
+    replaceFile = true;
+
+    const HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                     FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER fileSize;
+    FileHeader    header{};
+    DWORD         read = 0;
+    const bool    headerIsValid =
+        GetFileSizeEx(hFile, &fileSize) && ReadFile(hFile, &header, sizeof(header), &read, nullptr) &&
+        read == sizeof(header) && header.magic == pl2CacheMagic && header.version == pl2CacheVersion &&
+        header.entrySize == entrySize && memcmp(&header.builder, &builderKey, sizeof(BuilderKey)) == 0;
+    // A partially appended entry is ignored, and will be overwritten by the next one.
+    const uint64_t nbFileEntries =
+        headerIsValid && uint64_t(fileSize.QuadPart) >= entryAlignment
+            ? (uint64_t(fileSize.QuadPart) - entryAlignment) / entrySize
+            : 0;
+    const size_t nbEntries = size_t(std::min<uint64_t>(nbFileEntries, memoryBudget / entrySize));
+    // Read-only, hits are copied out of the views.
+    if (const HANDLE hMapping = nbEntries ? CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr)
+    {
+        for (size_t entryIndex = 0; entryIndex < nbEntries; entryIndex++)
+        {
+            const uint64_t offset = entryAlignment + uint64_t(entryIndex) * entrySize;
+            void* const    view =
+                MapViewOfFile(hMapping, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset), entrySize);
+            if (!view) break;
+            entries.push_back({static_cast<EntryHeader*>(view), true});
+        }
+        // The views keep a reference to the mapping
+        CloseHandle(hMapping);
+    }
+    CloseHandle(hFile);
+    if (entries.empty())
+    {
+        // Entries can still be appended to a valid file, even if none of them could be used.
+        replaceFile = !headerIsValid;
+        return false;
+    }
+    replaceFile = false;
+    LOGW(L"Mapped {} PL2 files from {}\n", entries.size(), path);
+    return true;
+}
+
+void* DetoursPL2Cache::Find(const uint8_t* palette, void* (*allocate)(size_t size))
+{
+    const uint64_t              paletteHash = DetoursHash64(palette, paletteBytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Entry& entry : entries)
+    {
+        // The hash only avoids comparing every palette, a collision must not return the wrong PL2.
+        if (entry.header->paletteHash == paletteHash && memcmp(entry.header->palette, palette, paletteBytes) == 0)
+        {
+            // Copied under the lock, as the entry could be evicted by a concurrent Store.
+            void* const pl2 = allocate(pl2Size);
+            if (pl2) memcpy(pl2, entry.header + 1, pl2Size);
+            return pl2;
+        }
+    }
+    return nullptr;
+}
+
+bool DetoursPL2Cache::Store(const uint8_t* palette, const void* pl2)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entrySize > memoryBudget) return false;
+    while ((entries.size() + 1) * entrySize > memoryBudget)
+        EvictOldestEntry();
+
+    EntryHeader* const header =
+        static_cast<EntryHeader*>(VirtualAlloc(nullptr, entrySize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!header) return false;
+    header->paletteHash = DetoursHash64(palette, paletteBytes);
+    memcpy(header->palette, palette, paletteBytes);
+    memcpy(header + 1, pl2, pl2Size);
+    // Building a PL2 is rare and takes much longer than writing it, so entries are saved right away.
+    if (!path.empty()) AppendToFile(header);
+    DWORD oldProtection;
+    VirtualProtect(header, entrySize, PAGE_READONLY, &oldProtection);
+    entries.push_back({header, false});
+    return true;
+}
+
+void DetoursPL2Cache::EvictOldestEntry()
+{
+    ReleaseEntry(entries.front());
+    entries.erase(entries.begin());
+}
+
+void DetoursPL2Cache::ReleaseEntry(const Entry& entry)
+{
+    if (entry.isMapped)
+        UnmapViewOfFile(entry.header);
+    else
+        VirtualFree(entry.header, 0, MEM_RELEASE);
+}
+
+bool DetoursPL2Cache::AppendToFile(const EntryHeader* header)
+{
+    // The file may still be mapped, so it can only be written to, not replaced nor truncated.
+    const HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, replaceFile ? CREATE_ALWAYS : OPEN_ALWAYS,
+                                     FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LOGW(L"Failed to open {}\n", path);
+        return false;
+    }
+
+    bool          success  = true;
+    DWORD         written  = 0;
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(hFile, &fileSize)) success = false;
+    else if (size_t(fileSize.QuadPart) < sizeof(FileHeader))
+    {
+        const FileHeader fileHeader{pl2CacheMagic, pl2CacheVersion, builderKey, uint32_t(entrySize)};
+        success =
+            WriteFile(hFile, &fileHeader, sizeof(fileHeader), &written, nullptr) && written == sizeof(fileHeader);
+        fileSize.QuadPart = 0;
+    }
+    // Overwrite what remains of an entry that was not fully written, the first one follows the file header padding.
+    const int64_t nbEntries = fileSize.QuadPart > int64_t(entryAlignment)
+                                  ? (fileSize.QuadPart - int64_t(entryAlignment)) / int64_t(entrySize)
+                                  : 0;
+    LARGE_INTEGER entryOffset;
+    entryOffset.QuadPart = int64_t(entryAlignment) + nbEntries * int64_t(entrySize);
+    success              = success && SetFilePointerEx(hFile, entryOffset, nullptr, FILE_BEGIN) != FALSE;
+    success = success && WriteFile(hFile, header, DWORD(entrySize), &written, nullptr) && written == entrySize;
+    CloseHandle(hFile);
+    if (success) replaceFile = false;
+    else LOGW(L"Failed to save a PL2 file to {}\n", path);
+    return success;
+}
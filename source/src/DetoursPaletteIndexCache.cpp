@@ -0,0 +1,131 @@
+#include "DetoursPaletteIndexCache.h"
+
+DetoursPaletteIndexCache::KeyMatch DetoursPaletteIndexCache::ReadSlotKey(const PaletteSlot& slot, const PaletteKey& key,
+                                                                         uint32_t& sequence) const
+{
+    sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) return KeyMatch::None;
+    bool matches = slot.palette.load(std::memory_order_relaxed) == key.palette &&
+                   slot.paletteSize.load(std::memory_order_relaxed) == key.paletteSize;
+    for (unsigned wordIndex = 0; matches && wordIndex < nbSnapshotWords; wordIndex++)
+        matches = slot.snapshot[wordIndex].load(std::memory_order_relaxed) == key.snapshot[wordIndex];
+    const bool hashMatches = slot.paletteHashLow.load(std::memory_order_relaxed) == uint32_t(key.paletteHash) &&
+                             slot.paletteHashHigh.load(std::memory_order_relaxed) == uint32_t(key.paletteHash >> 32);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!matches || slot.sequence.load(std::memory_order_relaxed) != sequence) return KeyMatch::None;
+    return hashMatches ? KeyMatch::Full : KeyMatch::Snapshot;
+}
+
+bool DetoursPaletteIndexCache::Lookup(const PaletteKey& key, uint32_t color, SlotVersion& version, uint8_t& index)
+{
+    for (PaletteSlot& slot : slots)
+    {
+        uint32_t sequence;
+        if (ReadSlotKey(slot, key, sequence) == KeyMatch::None) continue;
+        version = {&slot, sequence};
+        // Only write the shared cache line when the bit was cleared, not on every hit.
+        if (!slot.recentlyUsed.load(std::memory_order_relaxed))
+            slot.recentlyUsed.store(true, std::memory_order_relaxed);
+
+        const Table* table = slot.table.load(std::memory_order_acquire);
+        if (!table) return false;
+        // Entries are only written for the generation they were computed for, so an entry of this generation is valid
+        // for the key even if the slot was replaced since.
+        const uint32_t mixedColor = MixColor(color);
+        const uint32_t entry      = table->entries[mixedColor >> entryTagBits].load(std::memory_order_relaxed);
+        const uint32_t expected   = ((sequence >> 1) & entryGenerationMask) << entryGenerationShift | entryValidBit |
+                                  (mixedColor & ((1u << entryTagBits) - 1)) << 8;
+        if ((entry & ~0xFFu) != expected) return false;
+        index = uint8_t(entry & 0xFF);
+        return true;
+    }
+    version = SlotVersion();
+    return false;
+}
+
+void DetoursPaletteIndexCache::Store(const PaletteKey& key, uint32_t color, const SlotVersion& version, uint8_t index)
+{
+    // The slot was found from the snapshot only, the hash computed by this miss tells whether the rest of the palette
+    // changed since the slot was keyed, in which case it gets a new generation.
+    uint32_t sequence;
+    if (!version.slot || ReadSlotKey(*version.slot, key, sequence) != KeyMatch::Full)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ReplaceSlot(key);
+        return;
+    }
+
+    // Palettes used only a few times are not worth the table.
+    PaletteSlot& slot = *version.slot;
+    if (slot.nbMisses.load(std::memory_order_relaxed) < promotionThreshold)
+    {
+        slot.nbMisses.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Table* table = slot.table.load(std::memory_order_acquire);
+    if (!table)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Table>&     slotTable = tables[&slot - slots];
+        // Value initialized, so that every entry starts invalid.
+        if (!slotTable) slotTable.reset(new Table());
+        table = slotTable.get();
+        slot.table.store(table, std::memory_order_release);
+    }
+    const uint32_t mixedColor = MixColor(color);
+    const uint32_t entry      = ((version.sequence >> 1) & entryGenerationMask) << entryGenerationShift |
+                           entryValidBit | (mixedColor & ((1u << entryTagBits) - 1)) << 8 | index;
+    table->entries[mixedColor >> entryTagBits].store(entry, std::memory_order_relaxed);
+}
+
+void DetoursPaletteIndexCache::ReplaceSlot(const PaletteKey& key)
+{
+    // Another thread may have missed the same palette meanwhile.
+    // Keys are only written under the mutex, so the other fields can be read directly.
+    PaletteSlot* sameAddressSlot = nullptr;
+    for (PaletteSlot& slot : slots)
+    {
+        uint32_t sequence;
+        if (ReadSlotKey(slot, key, sequence) == KeyMatch::Full) return;
+        if (slot.palette.load(std::memory_order_relaxed) == key.palette &&
+            slot.paletteSize.load(std::memory_order_relaxed) == key.paletteSize)
+            sameAddressSlot = &slot;
+    }
+    // The palette was modified in place, its old content must not be hit anymore.
+    if (sameAddressSlot)
+    {
+        RekeySlot(*sameAddressSlot, key);
+        return;
+    }
+
+    // Clock replacement, advanced by one slot per miss: a slot used since the hand last passed is spared, so that
+    // palettes used once do not evict those used all the time, they will just be computed again.
+    PaletteSlot* const victim = &slots[clockHand];
+    clockHand                 = (clockHand + 1) % maxPalettes;
+    if (victim->recentlyUsed.exchange(false, std::memory_order_relaxed)) return;
+    RekeySlot(*victim, key);
+}
+
+void DetoursPaletteIndexCache::RekeySlot(PaletteSlot& slot, const PaletteKey& key)
+{
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.palette.store(key.palette, std::memory_order_relaxed);
+    slot.paletteSize.store(key.paletteSize, std::memory_order_relaxed);
+    for (unsigned wordIndex = 0; wordIndex < nbSnapshotWords; wordIndex++)
+        slot.snapshot[wordIndex].store(key.snapshot[wordIndex], std::memory_order_relaxed);
+    slot.paletteHashLow.store(uint32_t(key.paletteHash), std::memory_order_relaxed);
+    slot.paletteHashHigh.store(uint32_t(key.paletteHash >> 32), std::memory_order_relaxed);
+    slot.nbMisses.store(1, std::memory_order_relaxed);
+    // Only hits mark the slot, so that a palette used once is the next one replaced.
+    slot.recentlyUsed.store(false, std::memory_order_relaxed);
+    // Entries only keep the low bits of the generation, those of older generations must not come back.
+    Table* const table = slot.table.load(std::memory_order_relaxed);
+    if (table && (((sequence + 2) >> 1) & entryGenerationMask) == 0)
+    {
+        for (std::atomic<uint32_t>& entry : table->entries)
+            entry.store(0, std::memory_order_relaxed);
+    }
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
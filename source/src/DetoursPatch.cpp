@@ -6,9 +6,23 @@
 
 #define LOG_PREFIX "(D2detours.patch):"
 #include "Log.h"
-#include <unordered_map>
+#include "DetoursFlatPointerMap.h"
+#include "DetoursHookChain.h"
+#include "DetoursHookToggle.h"
+#include "DetoursJumpStub.h"
+#include "DetoursPEImage.h"
+#include "DetoursPageRuns.h"
+#include "DetoursSignatureCache.h"
+#include "DetoursSignatureScan.h"
+#include "DetoursTrace.h"
+#include <algorithm>
+#include <intrin.h>
+#include <map>
+#include <memory>
+#include <vector>
 
-bool getPatchInformationFunctions(LPCWSTR lpLibFileName, PatchInformationFunctions& functions, HMODULE hModulePatch)
+bool getPatchInformationFunctions(LPCWSTR lpLibFileName, PatchInformationFunctions& functions,
+                                  GetPatchActionsTableType& GetPatchActionsTable, HMODULE hModulePatch)
 {
     if (auto GetPatchInformationFunctions =
             (GetPatchInformationFunctionsType)GetProcAddress(hModulePatch, "GetPatchInformationFunctions"))
@@ -27,15 +41,75 @@ bool getPatchInformationFunctions(LPCWSTR lpLibFileName, PatchInformationFunctio
 
         // Extra patch actions are optional
     }
-    return functions.GetBaseOrdinal && functions.GetLastOrdinal && functions.GetPatchAction ||
+    GetPatchActionsTable = (GetPatchActionsTableType)GetProcAddress(hModulePatch, "GetPatchActionsTable");
+    return functions.GetBaseOrdinal && functions.GetLastOrdinal && (functions.GetPatchAction || GetPatchActionsTable) ||
            functions.GetExtraPatchActionsCount && functions.GetExtraPatchAction;
 }
 
+// Resolves the address of exported ordinals by reading the export address table of the module directly.
+// This is much cheaper than calling GetProcAddress for each ordinal.
+struct ModuleExports
+{
+    explicit ModuleExports(HMODULE hModule)
+        : hModule(hModule), image(hModule, DetourGetModuleSize(hModule), DetoursPEImage::Layout::Image)
+    {
+        if (image.GetExportDirectory(exportDirectory))
+            functionsRvas = (const DWORD*)image.RvaToPointer(exportDirectory.functionsRva,
+                                                             exportDirectory.nbFunctions * sizeof(DWORD));
+    }
+
+    PVOID GetOrdinalAddress(int ordinal) const
+    {
+        const DWORD functionIndex = DWORD(ordinal) - exportDirectory.ordinalBase;
+        if (!functionsRvas || functionIndex >= exportDirectory.nbFunctions)
+            return GetProcAddress(hModule, (LPCSTR)ordinal);
+
+        const DWORD rva = functionsRvas[functionIndex];
+        if (rva == 0) return nullptr;
+        // Let the loader resolve forwarded exports (and load the dll they forward to)
+        if (DetoursPEImage::IsForwardedExport(exportDirectory, rva)) return GetProcAddress(hModule, (LPCSTR)ordinal);
+        return PVOID(uintptr_t(hModule) + rva);
+    }
+
+    // Returns true if another export has the same address, such as the merged functions of D2Common.
+    bool IsAliased(int ordinal)
+    {
+        const DWORD functionIndex = DWORD(ordinal) - exportDirectory.ordinalBase;
+        if (!functionsRvas || functionIndex >= exportDirectory.nbFunctions || functionsRvas[functionIndex] == 0)
+            return false;
+        // Only sorted for the modules patched with ordinal thunks.
+        if (sortedFunctionsRvas.empty())
+        {
+            sortedFunctionsRvas.assign(functionsRvas, functionsRvas + exportDirectory.nbFunctions);
+            std::sort(sortedFunctionsRvas.begin(), sortedFunctionsRvas.end());
+        }
+        const auto aliases = std::equal_range(sortedFunctionsRvas.begin(), sortedFunctionsRvas.end(),
+                                              functionsRvas[functionIndex]);
+        return aliases.second - aliases.first > 1;
+    }
+
+    HMODULE                         hModule;
+    DetoursPEImage                  image;
+    DetoursPEImage::ExportDirectory exportDirectory;
+    const DWORD*                    functionsRvas = nullptr;
+    std::vector<DWORD>              sortedFunctionsRvas;
+};
+
 struct PatchHistory
 {
-    // Note: Since we use unordered_map, we can not patch allocation functions this way as they would allocate while
-    // being registered into the map.
-    std::unordered_map<void*, void*> patchedAddresses;
+    // The map does not allocate so that allocation functions can be patched too.
+    // This is enough for every ordinal of every D2 dll to be patched.
+    DetoursFlatPointerMap<1 << 14> patchedAddresses;
+    // Patched addresses in the order they were inserted, so that the patches of an aborted transaction can be forgotten.
+    void*  patchedAddressesJournal[decltype(patchedAddresses)::maxEntries];
+    size_t journalSize = 0;
+
+    size_t Checkpoint() const { return journalSize; }
+    void   Rollback(size_t checkpoint)
+    {
+        while (journalSize > checkpoint)
+            patchedAddresses.Erase(patchedAddressesJournal[--journalSize]);
+    }
 
     PatchActionReturn PatchChecks(const wchar_t* logPrefix,void* addressBeingPatched, void* patchAddress)
     {
@@ -46,18 +120,25 @@ struct PatchHistory
         // for example if you want to do some logging. This is also an issue if you want to put a breakpoint, as you
         // might trigger it even though it is not the ordinal you expected. The best way to fix this would be to hook
         // GetProcAddress to return the patched function directly.
-        auto inserted = patchedAddresses.insert({addressBeingPatched, patchAddress});
-        if (!inserted.second)
+        bool  inserted = false;
+        auto* entry    = patchedAddresses.Insert(addressBeingPatched, patchAddress, inserted);
+        if (!entry)
+        {
+            LOGW(L"{}Trying to patch address {} using {} but too many addresses were patched, skipping patch.\n",
+                 logPrefix, addressBeingPatched, patchAddress);
+            return PatchAction_PatchFailed;
+        }
+        if (!inserted)
         {
             LOGW(L"{}Trying to patch address {} using {} which was already patched by {}, skipping patch. This can lead to unwanted behavior "
                  L"(multiple functions could have been merged in original dll).\n",
-                 logPrefix, addressBeingPatched, patchAddress, inserted.first->second);
+                 logPrefix, addressBeingPatched, patchAddress, entry->value);
             return PatchAction_AlreadyPatched;
         }
-        auto it = patchedAddresses.find(patchAddress);
-        if (it != patchedAddresses.end())
+        patchedAddressesJournal[journalSize++] = addressBeingPatched;
+        if (const auto* it = patchedAddresses.Find(patchAddress))
         {
-            if (it->second == addressBeingPatched)
+            if (it->value == addressBeingPatched)
             {
                 LOGW(L"{}Trying to patch address {} using {} which itself was already patched by {}, skipping patch. "
                      L"This would lead to circular dependencies and infinite recursion.\n",
@@ -68,7 +149,7 @@ struct PatchHistory
             {
                 LOGW(L"{}Trying to patch address {} using {} which itself was already patched by {}, skipping patch. This could "
                      L"lead to circular dependencies, infinite recursion or other issues.\n",
-                     logPrefix, addressBeingPatched, patchAddress, it->second);
+                     logPrefix, addressBeingPatched, patchAddress, it->value);
                 return PatchAction_PatchFunctionWasPatched;
 			}
         }
@@ -77,16 +158,490 @@ struct PatchHistory
 };
 
 
+PatchHistory gPatchHistory;
+
+struct ImportPatches
+{
+    // Original function => patch function, also applied to the imports of the modules loaded afterwards.
+    DetoursFlatPointerMap<1 << 12> redirections;
+    // Original functions in insertion order, for transaction rollbacks.
+    std::vector<void*> journal;
+};
+static ImportPatches gImportPatches;
+
+struct HookChains
+{
+    // Original function => DetoursHookChain, chains are never destroyed once their detour was committed.
+    DetoursFlatPointerMap<1 << 10> chains;
+    // Chains to which the current transaction added handlers, and the ones it created.
+    std::vector<DetoursHookChain*> modified;
+    std::vector<DetoursHookChain*> created;
+};
+static HookChains gHookChains;
+
+static bool UseOrdinalThunks()
+{
+    wchar_t     envValue[8];
+    const DWORD envValueLen = GetEnvironmentVariableW(L"DIABLO2_PATCH_ORDINAL_THUNKS", envValue, _countof(envValue));
+    return envValueLen != 0 && envValueLen < _countof(envValue) && wcscmp(envValue, L"1") == 0;
+}
+
+// Ordinals sharing their address with other exports can not be detoured separately. When enabled, each of them gets a
+// jump stub of its own that is detoured instead, and is handed out by GetProcAddress and the imports of other modules.
+// Calls made from within the original module still go to the shared function.
+struct OrdinalThunk
+{
+    void* volatile function;
+    void*          thunk;
+    // Calls through its imports or GetProcAddress must reach the original function, as with import patches.
+    HMODULE        hPatchModule;
+};
+struct OrdinalThunks
+{
+    const bool enabled = UseOrdinalThunks();
+    // Module base + ordinal => OrdinalThunk, which is unique as modules are aligned to 64KiB and ordinals are 16 bits.
+    DetoursFlatPointerMap<1 << 12>             thunks;
+    // Never freed, as the callers may still run the thunks.
+    std::vector<std::unique_ptr<OrdinalThunk>> storage;
+    // Keys in insertion order, for transaction rollbacks.
+    std::vector<void*>                         journal;
+    FARPROC(WINAPI* TrueGetProcAddress)(HMODULE hModule, LPCSTR lpProcName) = GetProcAddress;
+    bool getProcAddressHooked = false;
+    // Set if the current transaction attached the GetProcAddress hook.
+    bool getProcAddressHookPending = false;
+};
+static OrdinalThunks gOrdinalThunks;
+
+static void* OrdinalThunkKey(HMODULE hModule, DWORD ordinal) { return (void*)(uintptr_t(hModule) + ordinal); }
+
+static const OrdinalThunk* FindOrdinalThunk(HMODULE hModule, DWORD ordinal)
+{
+    if (ordinal == 0 || ordinal > 0xFFFF) return nullptr;
+    const auto* entry = gOrdinalThunks.thunks.Find(OrdinalThunkKey(hModule, ordinal));
+    return entry ? (const OrdinalThunk*)entry->value : nullptr;
+}
+
+static FARPROC WINAPI GetProcAddressWithOrdinalThunks(HMODULE hModule, LPCSTR lpProcName)
+{
+    const FARPROC function = gOrdinalThunks.TrueGetProcAddress(hModule, lpProcName);
+    // D2 dlls import each other by ordinal, so names are not looked up.
+    if (!function || !IS_INTRESOURCE(lpProcName)) return function;
+    const OrdinalThunk* ordinalThunk = FindOrdinalThunk(hModule, DWORD(uintptr_t(lpProcName)));
+    if (!ordinalThunk || DetourGetContainingModule(_ReturnAddress()) == ordinalThunk->hPatchModule) return function;
+    return (FARPROC)ordinalThunk->thunk;
+}
+
+// Calls made by a DllPreLoadHook through its HookContext. If the transaction is aborted, the patch is retried by
+// replaying them, as patch dlls do not expect DllPreLoadHook to be called twice.
+struct PreLoadHookCall
+{
+    enum class Function
+    {
+        ApplyPatchAction,
+        ReplaceAnyFunction,
+        ChainFunction,
+    };
+    Function    function;
+    void*       originalAddress;
+    void*       patchAddress;
+    PatchAction patchAction;
+    int         priority;
+    void**      storage;
+};
+struct PreLoadHookRecord
+{
+    uint32_t                     result = 0;
+    std::vector<PreLoadHookCall> calls;
+};
+struct PreLoadHookRecords
+{
+    // Keyed by the original and patch modules, kept until a transaction using them is committed.
+    std::map<std::pair<HMODULE, HMODULE>, PreLoadHookRecord> records;
+    // Records created or replayed by the current transaction.
+    std::vector<std::pair<HMODULE, HMODULE>> used;
+};
+static PreLoadHookRecords gPreLoadHookRecords;
+
+struct PatchTransaction
+{
+    int    depth             = 0;
+    bool   failed            = false;
+    size_t historyCheckpoint = 0;
+    // DetourAttach writes the trampoline addresses when committing, so the storage must outlive the whole transaction.
+    std::vector<std::unique_ptr<PVOID[]>> keepAlivePointers;
+    // Pointer patches are only written once the transaction is committed, grouped by pages.
+    std::vector<DetoursPointerWrite> pendingPointerWrites;
+    size_t                           importPatchesCheckpoint = 0;
+    size_t                           ordinalThunksCheckpoint = 0;
+    size_t                           hookTogglesCheckpoint   = 0;
+
+    // Instrumentation
+    unsigned nbCommits   = 0;
+    unsigned nbAborts    = 0;
+    LONGLONG commitTicks = 0;
+};
+static PatchTransaction gPatchTransaction;
+
+static bool IsWritableProtection(DWORD protect)
+{
+    return (protect & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+}
+
+struct ProtectedRegion
+{
+    uintptr_t begin;
+    SIZE_T    size;
+    DWORD     oldProtect;
+};
+
+static void RestoreProtections(std::vector<ProtectedRegion>& protectedRegions)
+{
+    for (const ProtectedRegion& region : protectedRegions)
+    {
+        DWORD oldProtect;
+        VirtualProtect((LPVOID)region.begin, region.size, region.oldProtect, &oldProtect);
+    }
+    protectedRegions.clear();
+}
+
+// Data tables such as .rdata or the Import Address Tables are read-only, so this changes the protection once per run of
+// pages instead of once per pointer.
+// Returns false, with every protection restored, if a page can not be made writable. Nothing must be written then.
+static bool UnprotectPointerWrites(std::vector<DetoursPointerWrite>& writes,
+                                   std::vector<ProtectedRegion>&     protectedRegions)
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+
+    const bool writable = DetoursMakePointerWritesWritable(
+        writes, systemInfo.dwPageSize,
+        [&](uintptr_t runBegin, uintptr_t runEnd)
+        {
+            // A run may span regions with different protections, and VirtualProtect only returns the previous
+            // protection of the first page.
+            for (uintptr_t regionBegin = runBegin; regionBegin < runEnd;)
+            {
+                MEMORY_BASIC_INFORMATION info;
+                bool regionWritable = VirtualQuery((LPCVOID)regionBegin, &info, sizeof(info)) && info.State == MEM_COMMIT;
+                const uintptr_t regionEnd =
+                    regionWritable ? (std::min)(runEnd, uintptr_t(info.BaseAddress) + info.RegionSize) : runEnd;
+                if (regionWritable && !IsWritableProtection(info.Protect))
+                {
+                    const DWORD newProtect =
+                        (info.Protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ)) ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE;
+                    DWORD oldProtect;
+                    regionWritable =
+                        VirtualProtect((LPVOID)regionBegin, regionEnd - regionBegin, newProtect, &oldProtect);
+                    if (regionWritable) protectedRegions.push_back({regionBegin, regionEnd - regionBegin, oldProtect});
+                }
+                if (!regionWritable)
+                {
+                    LOGW(L"Failed to make pages {} to {} writable.\n", (void*)regionBegin, (void*)regionEnd);
+                    return false;
+                }
+                regionBegin = regionEnd;
+            }
+            return true;
+        });
+    if (!writable) RestoreProtections(protectedRegions);
+    return writable;
+}
+
+// Writes the pointers outside of any transaction, returns false if none was written.
+static bool FlushPointerWrites(std::vector<DetoursPointerWrite>& writes)
+{
+    std::vector<ProtectedRegion> protectedRegions;
+    const bool                   writable = UnprotectPointerWrites(writes, protectedRegions);
+    if (writable) DetoursApplyPointerWrites(writes);
+    RestoreProtections(protectedRegions);
+    writes.clear();
+    return writable;
+}
+
+bool DetoursPatchTransactionBegin()
+{
+    PatchTransaction& transaction = gPatchTransaction;
+    if (transaction.depth++ > 0) return true;
+
+    if (DetourTransactionBegin() != NO_ERROR)
+    {
+        transaction.depth = 0;
+        return false;
+    }
+    DetourUpdateThread(GetCurrentThread());
+    transaction.failed            = false;
+    transaction.historyCheckpoint       = gPatchHistory.Checkpoint();
+    transaction.importPatchesCheckpoint = gImportPatches.journal.size();
+    transaction.ordinalThunksCheckpoint = gOrdinalThunks.journal.size();
+    transaction.hookTogglesCheckpoint   = DetoursHookTogglesCheckpoint();
+    return true;
+}
+
+void DetoursPatchTransactionFail() { gPatchTransaction.failed = true; }
+
+bool DetoursPatchTransactionCommit()
+{
+    PatchTransaction& transaction = gPatchTransaction;
+    assert(transaction.depth > 0);
+    if (--transaction.depth > 0) return !transaction.failed;
+
+    bool committed = false;
+    if (!transaction.failed)
+    {
+        LARGE_INTEGER commitStart, commitEnd;
+        QueryPerformanceCounter(&commitStart);
+        DetoursTraceScope traceScope("Commit patch transaction");
+        // Pointer patches are part of the transaction, so their pages are made writable before committing the detours,
+        // and the transaction is aborted if one of them can not be.
+        // DetourAttach already made the pages of the detoured functions PAGE_EXECUTE_READWRITE, and the commit restores
+        // their previous protection. Pointers on those pages look writable now but are read-only again after the
+        // commit, so their pages are unprotected a second time once the commit is done. The regions are then restored
+        // in the reverse order, so that each page gets back the protection it had before the transaction.
+        std::vector<ProtectedRegion> protectedRegions;
+        if (UnprotectPointerWrites(transaction.pendingPointerWrites, protectedRegions))
+        {
+            const LONG error = DetourTransactionCommit();
+            committed        = error == NO_ERROR;
+            if (committed)
+            {
+                std::vector<ProtectedRegion> detouredRegions;
+                if (UnprotectPointerWrites(transaction.pendingPointerWrites, detouredRegions))
+                    DetoursApplyPointerWrites(transaction.pendingPointerWrites);
+                else LOGW(L"Detoured pages could not be made writable again, pointer patches were not written.\n");
+                RestoreProtections(detouredRegions);
+                for (DetoursHookChain* chain : gHookChains.modified)
+                {
+                    chain->Commit();
+                    LOGW(L"Chain of {} now has {} handlers\n", chain->GetOriginalFunction(), chain->GetNbHandlers());
+                }
+            }
+            else LOGW(L"Failed to commit transaction with error {}\n", (void*)error);
+            RestoreProtections(protectedRegions);
+        }
+        else
+        {
+            LOGW(L"Some pointers can not be patched, aborting the transaction.\n");
+            DetourTransactionAbort();
+        }
+        QueryPerformanceCounter(&commitEnd);
+        transaction.commitTicks += commitEnd.QuadPart - commitStart.QuadPart;
+        transaction.nbCommits++;
+    }
+    else
+    {
+        DetourTransactionAbort();
+    }
+
+    if (!committed)
+    {
+        LOGW(L"Transaction aborted, rolling back its patches.\n");
+        transaction.nbAborts++;
+        gPatchHistory.Rollback(transaction.historyCheckpoint);
+        while (gImportPatches.journal.size() > transaction.importPatchesCheckpoint)
+        {
+            gImportPatches.redirections.Erase(gImportPatches.journal.back());
+            gImportPatches.journal.pop_back();
+        }
+        // The imports were not redirected to these thunks, so they must be created again.
+        while (gOrdinalThunks.journal.size() > transaction.ordinalThunksCheckpoint)
+        {
+            gOrdinalThunks.thunks.Erase(gOrdinalThunks.journal.back());
+            gOrdinalThunks.journal.pop_back();
+        }
+        if (gOrdinalThunks.getProcAddressHookPending) gOrdinalThunks.getProcAddressHooked = false;
+        DetoursHookTogglesRollback(transaction.hookTogglesCheckpoint);
+        for (DetoursHookChain* chain : gHookChains.modified)
+            chain->Abort();
+        // Their detour was not committed, so nothing can run their stub.
+        for (DetoursHookChain* chain : gHookChains.created)
+        {
+            gHookChains.chains.Erase(chain->GetOriginalFunction());
+            delete chain;
+        }
+    }
+    // A committed DllPreLoadHook will not be retried.
+    if (committed)
+    {
+        for (const auto& recordKey : gPreLoadHookRecords.used)
+            gPreLoadHookRecords.records.erase(recordKey);
+    }
+    gPreLoadHookRecords.used.clear();
+    gOrdinalThunks.getProcAddressHookPending = false;
+    gHookChains.modified.clear();
+    gHookChains.created.clear();
+    transaction.keepAlivePointers.clear();
+    transaction.pendingPointerWrites.clear();
+    return committed;
+}
+
+PVOID* DetoursPatchTransactionAllocPointers(size_t count)
+{
+    assert(gPatchTransaction.depth > 0);
+    gPatchTransaction.keepAlivePointers.emplace_back(new PVOID[count]());
+    return gPatchTransaction.keepAlivePointers.back().get();
+}
+
+void DetoursPatchTransactionLogStats()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    LOG("Detours transactions: {} commits ({} aborted) in {:.3f}ms\n", gPatchTransaction.nbCommits,
+        gPatchTransaction.nbAborts, double(gPatchTransaction.commitTicks) * 1000.0 / double(frequency.QuadPart));
+}
+
+static void QueuePointerWrite(PVOID* address, PVOID value)
+{
+    gPatchTransaction.pendingPointerWrites.push_back({address, value});
+}
+
+// The value is only read when the writes are flushed, so that it includes the writes queued before this one.
+static void QueuePointerCopy(PVOID* address, PVOID* source)
+{
+    gPatchTransaction.pendingPointerWrites.push_back({address, nullptr, source});
+}
+
+struct ModuleImportsPatching
+{
+    HMODULE                          hImporter;
+    HMODULE                          hImported = nullptr;
+    std::vector<DetoursPointerWrite> writes;
+};
+
+static BOOL CALLBACK CollectImportedModule(PVOID pContext, HMODULE hModule, LPCSTR)
+{
+    ((ModuleImportsPatching*)pContext)->hImported = hModule;
+    return TRUE;
+}
+
+static BOOL CALLBACK CollectImportSlotsToPatch(PVOID pContext, DWORD nOrdinal, LPCSTR pszFunc, PVOID* ppvFunc)
+{
+    // Called with nullptr at the end of each imported module
+    if (!ppvFunc) return TRUE;
+    auto&       patching    = *(ModuleImportsPatching*)pContext;
+    const auto* redirection = gImportPatches.redirections.Find(*ppvFunc);
+    // The patch must still be able to call the original function through its own imports.
+    if (redirection && DetourGetContainingModule(redirection->value) != patching.hImporter)
+        patching.writes.push_back({ppvFunc, redirection->value});
+    else if (!pszFunc && gOrdinalThunks.thunks.Size() != 0)
+    {
+        const OrdinalThunk* ordinalThunk = FindOrdinalThunk(patching.hImported, nOrdinal);
+        if (ordinalThunk && *ppvFunc == ordinalThunk->function && ordinalThunk->hPatchModule != patching.hImporter)
+            patching.writes.push_back({ppvFunc, ordinalThunk->thunk});
+    }
+    return TRUE;
+}
+
+static size_t PatchModuleImports(HMODULE hModule)
+{
+    ModuleImportsPatching patching{hModule};
+    if (!DetourEnumerateImportsEx(hModule, &patching, CollectImportedModule, CollectImportSlotsToPatch)) return 0;
+
+    for (const DetoursPointerWrite& write : patching.writes)
+        QueuePointerWrite(write.address, write.value);
+    return patching.writes.size();
+}
+
+void DetoursPatchModuleImports(HMODULE hModule)
+{
+    if (!DetoursHasImportPatches()) return;
+    // New modules are patched outside of any transaction unless a patch loaded them, most have nothing to write.
+    if (PatchModuleImports(hModule) != 0 && gPatchTransaction.depth == 0 &&
+        !FlushPointerWrites(gPatchTransaction.pendingPointerWrites))
+        LOGW(L"Failed to patch the imports of module {}\n", (void*)hModule);
+}
+
+bool DetoursHasImportPatches()
+{
+    return gImportPatches.redirections.Size() != 0 || gOrdinalThunks.thunks.Size() != 0;
+}
+
+// Returns the thunk to detour instead of function, or function itself if no thunk could be created.
+static PVOID GetOrdinalThunk(HMODULE hOriginalModule, int ordinal, PVOID function, HMODULE hPatchModule,
+                             bool& newThunk)
+{
+    newThunk = false;
+    if (const OrdinalThunk* ordinalThunk = FindOrdinalThunk(hOriginalModule, DWORD(ordinal)))
+        return ordinalThunk->thunk;
+
+    std::unique_ptr<OrdinalThunk> ordinalThunk(new OrdinalThunk{function, nullptr, hPatchModule});
+    ordinalThunk->thunk = DetoursAllocateJumpStub(&ordinalThunk->function);
+    void* const key      = OrdinalThunkKey(hOriginalModule, DWORD(ordinal));
+    bool        inserted = false;
+    if (!ordinalThunk->thunk || !gOrdinalThunks.thunks.Insert(key, ordinalThunk.get(), inserted))
+    {
+        LOGW(L"Could not create a thunk for ordinal {}, it will be patched at its shared address.\n", ordinal);
+        return function;
+    }
+    if (!gOrdinalThunks.getProcAddressHooked)
+    {
+        const LONG err = DetourAttach(&(PVOID&)gOrdinalThunks.TrueGetProcAddress, GetProcAddressWithOrdinalThunks);
+        if (err != NO_ERROR) LOGW(L"Failed to hook GetProcAddress with error {}\n", (void*)err);
+        gOrdinalThunks.getProcAddressHooked      = err == NO_ERROR;
+        gOrdinalThunks.getProcAddressHookPending = err == NO_ERROR;
+    }
+    LOGW_VERBOSE(L"Ordinal {} shares its address {}, patching it through thunk {}\n", ordinal, function,
+                 ordinalThunk->thunk);
+    newThunk          = true;
+    const PVOID thunk = ordinalThunk->thunk;
+    gOrdinalThunks.journal.push_back(key);
+    gOrdinalThunks.storage.push_back(std::move(ordinalThunk));
+    return thunk;
+}
+
+static bool PatchImports(PVOID originalFunction, PVOID patchFunction)
+{
+    bool inserted = false;
+    if (!gImportPatches.redirections.Insert(originalFunction, patchFunction, inserted))
+    {
+        LOGW(L"Too many imports patched, could not patch {}\n", originalFunction);
+        return false;
+    }
+    if (!inserted)
+    {
+        LOGW(L"Imports of {} are already patched, could not patch them with {}\n", originalFunction, patchFunction);
+        return false;
+    }
+    gImportPatches.journal.push_back(originalFunction);
+
+    size_t nbPatchedSlots = 0;
+    for (HMODULE hModule = nullptr; (hModule = DetourEnumerateModules(hModule)) != nullptr;)
+        nbPatchedSlots += PatchModuleImports(hModule);
+    LOGW(L"Patched {} imports of {} with {}\n", nbPatchedSlots, originalFunction, patchFunction);
+    return true;
+}
+
+// Detours originalFunction to the stub of a DetoursHookToggle, which calls the patch function while it is enabled.
+static LONG AttachToggleableHook(PVOID* realPatchedFunctionPtr, PVOID patchFunction)
+{
+    DetoursHookToggle* toggle = DetoursHookToggle::Create(*realPatchedFunctionPtr, patchFunction);
+    if (!toggle) return ERROR_NOT_ENOUGH_MEMORY;
+    if (!DetoursRegisterHookToggle(toggle)) return ERROR_NOT_ENOUGH_MEMORY;
+
+    PDETOUR_TRAMPOLINE trampoline = nullptr;
+    const LONG err = DetourAttachEx(realPatchedFunctionPtr, toggle->GetStub(), &trampoline, nullptr, nullptr);
+    // The code of the trampoline starts at its address.
+    if (err == NO_ERROR) toggle->SetTrampoline(trampoline);
+    return err;
+}
+
+LONG DetoursPatchTransactionAttach(PVOID* realPatchedFunctionPtr, PVOID patchFunction)
+{
+    if (DetoursUseHookToggles()) return AttachToggleableHook(realPatchedFunctionPtr, patchFunction);
+    return DetourAttach(realPatchedFunctionPtr, patchFunction);
+}
 
 PatchActionReturn ApplyPatchAction(PatchHistory& patchHistory, PVOID originalAddress, PVOID patchAddress,
                                    PatchAction patchAction, PVOID* realPatchedFunctionPtr = nullptr)
 {
     if (patchAction == PatchAction::Ignore) return PatchAction_Success;
     if (originalAddress == nullptr || patchAddress == nullptr) { return PatchAction_BadInput; }
+    // Patches are rolled back if the transaction fails, so we must be in one.
+    assert(gPatchTransaction.depth > 0);
     switch (patchAction)
     {
     case PatchAction::FunctionReplaceOriginalByPatch:
     case PatchAction::PointerReplaceOriginalByPatch:
+    case PatchAction::ImportReplaceOriginalByPatch:
     {
         PatchActionReturn r = patchHistory.PatchChecks(L"Original<==Patch:", originalAddress, patchAddress);
         if (r != PatchAction_Success) return r;
@@ -105,21 +660,22 @@ PatchActionReturn ApplyPatchAction(PatchHistory& patchHistory, PVOID originalAdd
     switch (patchAction)
     {
     case PatchAction::FunctionReplaceOriginalByPatch:
-        if (realPatchedFunctionPtr)
-            *realPatchedFunctionPtr = originalAddress;
-        else
-            realPatchedFunctionPtr = &originalAddress;
-        err = DetourAttach(realPatchedFunctionPtr, patchAddress);
+        if (!realPatchedFunctionPtr) realPatchedFunctionPtr = DetoursPatchTransactionAllocPointers(1);
+        *realPatchedFunctionPtr = originalAddress;
+        err = DetoursPatchTransactionAttach(realPatchedFunctionPtr, patchAddress);
         break;
     case PatchAction::FunctionReplacePatchByOriginal:
-        if (realPatchedFunctionPtr)
-            *realPatchedFunctionPtr = patchAddress;
-        else
-            realPatchedFunctionPtr = &patchAddress;
+        if (!realPatchedFunctionPtr) realPatchedFunctionPtr = DetoursPatchTransactionAllocPointers(1);
+        *realPatchedFunctionPtr = patchAddress;
         err = DetourAttach(realPatchedFunctionPtr, originalAddress);
         break;
-    case PatchAction::PointerReplaceOriginalByPatch: *(void**)originalAddress = *(void**)patchAddress; break;
-    case PatchAction::PointerReplacePatchByOriginal: *(void**)patchAddress = *(void**)originalAddress; break;
+    case PatchAction::PointerReplaceOriginalByPatch: QueuePointerCopy((PVOID*)originalAddress, (PVOID*)patchAddress); break;
+    case PatchAction::PointerReplacePatchByOriginal: QueuePointerCopy((PVOID*)patchAddress, (PVOID*)originalAddress); break;
+    case PatchAction::ImportReplaceOriginalByPatch:
+        // The original code is untouched, so it can be called directly.
+        if (realPatchedFunctionPtr) *realPatchedFunctionPtr = originalAddress;
+        if (!PatchImports(originalAddress, patchAddress)) err = ERROR_NOT_ENOUGH_MEMORY;
+        break;
     case PatchAction::Ignore: // Should not reach here since checked before
         break;
     }
@@ -131,9 +687,172 @@ PatchActionReturn ApplyPatchAction(PatchHistory& patchHistory, PVOID originalAdd
     return PatchAction_Success;
 }
 
-PatchHistory gPatchHistory;
+PatchActionReturn ChainFunction(PatchHistory& patchHistory, PVOID originalFunction, PVOID patchFunction, int priority,
+                                PVOID* nextFunctionStorage)
+{
+    if (originalFunction == nullptr || patchFunction == nullptr) return PatchAction_BadInput;
+    // Handlers are only linked when the transaction is committed.
+    assert(gPatchTransaction.depth > 0);
+    if (patchHistory.patchedAddresses.Find(patchFunction))
+    {
+        LOGW(L"Chain:Trying to chain {} to {} but it was itself patched, skipping patch.\n", patchFunction,
+             originalFunction);
+        return PatchAction_PatchFunctionWasPatched;
+    }
+
+    const auto*       chainEntry = gHookChains.chains.Find(originalFunction);
+    DetoursHookChain* chain      = chainEntry ? (DetoursHookChain*)chainEntry->value : nullptr;
+    if (!chain)
+    {
+        std::unique_ptr<DetoursHookChain> newChain(DetoursHookChain::Create(originalFunction));
+        if (!newChain) return PatchAction_PatchFailed;
+        // Replacing the function by the stub of the chain prevents other patches from replacing it.
+        const PatchActionReturn r = patchHistory.PatchChecks(L"Chain:", originalFunction, newChain->GetStub());
+        if (r != PatchAction_Success) return r;
+
+        // Registered before its detour is queued, so that an aborted transaction always finds and frees the chain.
+        // From then on every failure must abort the transaction, which also rolls back the history.
+        bool inserted = false;
+        if (!gHookChains.chains.Insert(originalFunction, newChain.get(), inserted))
+        {
+            LOGW(L"Too many chained functions, could not chain {}\n", originalFunction);
+            DetoursPatchTransactionFail();
+            return PatchAction_PatchFailed;
+        }
+        chain = newChain.release();
+        gHookChains.created.push_back(chain);
+
+        // The trampoline is known right away, so the stub never jumps to an unset address even if the function is
+        // called before the handlers are linked.
+        PDETOUR_TRAMPOLINE trampoline = nullptr;
+        PVOID              realDetour = nullptr;
+        PVOID* const       pointer    = DetoursPatchTransactionAllocPointers(1);
+        *pointer                      = originalFunction;
+        const LONG err = DetourAttachEx(pointer, chain->GetStub(), &trampoline, nullptr, &realDetour);
+        if (err != NO_ERROR)
+        {
+            LOGW(L"Failed to chain {} with error {}\n", originalFunction, (void*)err);
+            DetoursPatchTransactionFail();
+            return PatchAction_PatchFailed;
+        }
+        if (realDetour != chain->GetStub())
+        {
+            // Detours followed the jump of the stub, the detour is already queued so it must not be committed.
+            LOGW(L"Failed to chain {}, the stub was skipped\n", originalFunction);
+            DetoursPatchTransactionFail();
+            return PatchAction_PatchFailed;
+        }
+        // The code of the trampoline starts at its address.
+        chain->SetTrampoline(trampoline);
+    }
+    else if (chain->Contains(patchFunction))
+    {
+        LOGW(L"Chain:{} is already chained to {}, skipping patch.\n", patchFunction, originalFunction);
+        return PatchAction_AlreadyPatched;
+    }
+
+    chain->AddPending(patchFunction, priority, nextFunctionStorage);
+    if (std::find(gHookChains.modified.begin(), gHookChains.modified.end(), chain) == gHookChains.modified.end())
+        gHookChains.modified.push_back(chain);
+    LOGW_VERBOSE(L"Chained {} to {} with priority {}\n", patchFunction, originalFunction, priority);
+    return PatchAction_Success;
+}
+
+static std::unique_ptr<DetoursSignatureCache> gSignatureCache;
+
+void DetoursLoadSignatureCache(const wchar_t* cachePath)
+{
+    gSignatureCache.reset(new DetoursSignatureCache(cachePath));
+    gSignatureCache->Load();
+}
+
+void DetoursSaveSignatureCache()
+{
+    if (gSignatureCache) gSignatureCache->SaveIfModified();
+}
+
+static size_t FindSignatureInModule(HMODULE hModule, const char* pattern, uintptr_t* offsets, size_t maxOffsets)
+{
+    DetoursSignature signature;
+    if (!pattern || !signature.Parse(pattern))
+    {
+        LOGW(L"Invalid signature pattern.\n");
+        return 0;
+    }
+
+    const uint8_t* const moduleBase = (const uint8_t*)hModule;
+    const DetoursPEImage image(moduleBase, DetourGetModuleSize(hModule), DetoursPEImage::Layout::Image);
+    const DetoursSignatureCache::ModuleKey moduleKey{image.GetTimeDateStamp(), image.GetCheckSum(),
+                                                     image.GetSizeOfImage()};
+    const uint64_t                         patternHash = signature.Hash();
+
+    // Cached offsets can be used as is if they still match, which only costs a comparison per offset.
+    const DetoursSignatureCache::Entry* cachedEntry =
+        gSignatureCache ? gSignatureCache->Find(moduleKey, patternHash) : nullptr;
+    if (cachedEntry && cachedEntry->offsets.size() >= std::min<size_t>(cachedEntry->nbMatches, maxOffsets))
+    {
+        bool cachedOffsetsMatch = true;
+        for (uint32_t offset : cachedEntry->offsets)
+        {
+            const uint8_t* data = image.RvaToPointer(offset, signature.Size());
+            cachedOffsetsMatch  = cachedOffsetsMatch && data && signature.Matches(data);
+        }
+        if (cachedOffsetsMatch)
+        {
+            const size_t nbOffsets = std::min(cachedEntry->offsets.size(), maxOffsets);
+            for (size_t offsetIndex = 0; offsetIndex < nbOffsets; offsetIndex++)
+                offsets[offsetIndex] = cachedEntry->offsets[offsetIndex];
+            return cachedEntry->nbMatches;
+        }
+    }
+
+    DetoursSignatureCache::Entry entry;
+    entry.module      = moduleKey;
+    entry.patternHash = patternHash;
+    size_t nbMatches  = 0;
+    for (uint16_t sectionIndex = 0; sectionIndex < image.GetSectionsCount(); sectionIndex++)
+    {
+        DetoursPEImage::Section section;
+        if (!image.GetSection(sectionIndex, section) || !(section.characteristics & DetoursPEImage::sectionExecutable))
+            continue;
+        const size_t   sectionSize = std::min(section.virtualSize, image.GetSizeOfImage() - section.virtualAddress);
+        const uint8_t* sectionData = image.RvaToPointer(section.virtualAddress, sectionSize);
+        if (!sectionData) continue;
+
+        for (size_t match = signature.Find(sectionData, sectionSize); match != sectionSize;
+             match        = signature.Find(sectionData, sectionSize, match + 1))
+        {
+            const uint32_t offset = uint32_t(sectionData + match - moduleBase);
+            if (nbMatches < maxOffsets) offsets[nbMatches] = offset;
+            if (nbMatches < DetoursSignatureCache::maxCachedOffsets) entry.offsets.push_back(offset);
+            nbMatches++;
+        }
+    }
+    entry.nbMatches = uint32_t(nbMatches);
+    if (gSignatureCache) gSignatureCache->Store(std::move(entry));
+    return nbMatches;
+}
+
+// Same as the HookContext::ReplaceAnyFunction given to patch dlls, no sanity checks are done.
+static PatchActionReturn ReplaceAnyFunction(void* originalFunction, void* patchFunction,
+                                            void** realPatchedFunctionStorage)
+{
+    if (!realPatchedFunctionStorage) realPatchedFunctionStorage = DetoursPatchTransactionAllocPointers(1);
+    *realPatchedFunctionStorage = originalFunction;
+    LONG err = DetoursPatchTransactionAttach(realPatchedFunctionStorage, patchFunction);
+
+    if (err != NO_ERROR)
+    {
+        LOGW(L"Failed to patch with error {}\n", (void*)err);
+        return PatchAction_PatchFailed;
+    }
+    return PatchAction_Success;
+}
+
 struct HookContextData {
     PatchHistory& patchHistory = ::gPatchHistory;
+    // Set while DllPreLoadHook runs for the first time.
+    PreLoadHookRecord* preLoadHookRecord = nullptr;
 #ifndef NDEBUG
     bool hasModuleInfo = false;
     MODULEINFO originalModuleInfo;
@@ -141,6 +860,26 @@ struct HookContextData {
 #endif
 };
 
+// The results are ignored as DllPreLoadHook already handled them the first time.
+static void ReplayPreLoadHook(PatchHistory& patchHistory, const PreLoadHookRecord& record)
+{
+    for (const PreLoadHookCall& call : record.calls)
+    {
+        switch (call.function)
+        {
+        case PreLoadHookCall::Function::ApplyPatchAction:
+            ApplyPatchAction(patchHistory, call.originalAddress, call.patchAddress, call.patchAction, call.storage);
+            break;
+        case PreLoadHookCall::Function::ReplaceAnyFunction:
+            ReplaceAnyFunction(call.originalAddress, call.patchAddress, call.storage);
+            break;
+        case PreLoadHookCall::Function::ChainFunction:
+            ChainFunction(patchHistory, call.originalAddress, call.patchAddress, call.priority, call.storage);
+            break;
+        }
+    }
+}
+
 static bool AddressIsInModule(void* address, MODULEINFO& moduleInfo)
 {
     const uintptr_t comparableAddr = uintptr_t(address);
@@ -148,9 +887,9 @@ static bool AddressIsInModule(void* address, MODULEINFO& moduleInfo)
            comparableAddr < (uintptr_t(moduleInfo.lpBaseOfDll) + moduleInfo.SizeOfImage);
 }
 
-bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE hPatchModule,
-                        std::vector<PVOID>& ordinalDetouredAddresses)
+bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE hPatchModule)
 {
+    DetoursTraceScope traceScope("Patch module", lpLibFileName);
     HookContextData ctxData{};
 #ifndef NDEBUG
     ctxData.hasModuleInfo =
@@ -161,6 +900,22 @@ bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE
     ctx.pContextPrivateData = &ctxData;
     ctx.hOriginalModule     = hOriginalModule;
     ctx.hPatchModule        = hPatchModule;
+    ctx.FindSignature       = [](HookContext* context, const char* pattern, uintptr_t* originalDllOffsets,
+                           size_t maxOffsets) {
+        return FindSignatureInModule((HMODULE)context->hOriginalModule, pattern, originalDllOffsets, maxOffsets);
+    };
+    ctx.ChainFunction = [](HookContext* context, uintptr_t originalDllOffset, void* patchFunction, int priority,
+                           void** nextFunctionStorage) {
+        HookContextData& ctxData          = *(HookContextData*)context->pContextPrivateData;
+        void*            originalFunction = (void*)(uintptr_t(context->hOriginalModule) + originalDllOffset);
+        if (ctxData.preLoadHookRecord)
+        {
+            ctxData.preLoadHookRecord->calls.push_back({PreLoadHookCall::Function::ChainFunction, originalFunction,
+                                                        patchFunction, PatchAction::Ignore, priority,
+                                                        nextFunctionStorage});
+        }
+        return ChainFunction(ctxData.patchHistory, originalFunction, patchFunction, priority, nextFunctionStorage);
+    };
 
     auto DllPreLoadHook = (DllPreLoadHookType)GetProcAddress(hPatchModule, "DllPreLoadHook");
     if (DllPreLoadHook)
@@ -176,26 +931,45 @@ bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE
             assert(!ctxData.hasModuleInfo || (!AddressIsInModule(originalAddr, ctxData.patchModuleInfo) &&
                                               !AddressIsInModule(patchAddr, ctxData.originalModuleInfo)));
 #endif
+            if (ctxData.preLoadHookRecord)
+            {
+                ctxData.preLoadHookRecord->calls.push_back({PreLoadHookCall::Function::ApplyPatchAction, originalAddr,
+                                                            patchAddr, patchAction, 0, realPatchedFunction});
+            }
             return ApplyPatchAction(ctxData.patchHistory, originalAddr, patchAddr, patchAction, realPatchedFunction);
         };
         ctx.ReplaceAnyFunction =
             [](HookContext* context, void* originalFunction, void* patchFunction, void** realPatchedFunctionStorage)
         {
-            if (realPatchedFunctionStorage)
-                *realPatchedFunctionStorage = originalFunction;
-            else
-                realPatchedFunctionStorage = &originalFunction;
-            LONG err = DetourAttach(realPatchedFunctionStorage, patchFunction);
-
-            if (err != NO_ERROR)
+            HookContextData& ctxData = *(HookContextData*)context->pContextPrivateData;
+            if (ctxData.preLoadHookRecord)
             {
-                LOGW(L"Failed to patch with error {}\n", (void*)err);
-                return PatchAction_PatchFailed;
+                ctxData.preLoadHookRecord->calls.push_back({PreLoadHookCall::Function::ReplaceAnyFunction,
+                                                            originalFunction, patchFunction, PatchAction::Ignore, 0,
+                                                            realPatchedFunctionStorage});
             }
-            return PatchAction_Success;
+            return ReplaceAnyFunction(originalFunction, patchFunction, realPatchedFunctionStorage);
         };
 
-        if (uint32_t err = DllPreLoadHook(&ctx, lpLibFileName))
+        const std::pair<HMODULE, HMODULE> recordKey{hOriginalModule, hPatchModule};
+        const auto                        recordIt = gPreLoadHookRecords.records.find(recordKey);
+        uint32_t                          err      = 0;
+        if (recordIt != gPreLoadHookRecords.records.end())
+        {
+            LOGW(L"Replaying the {} calls made by DllPreLoadHook.\n", recordIt->second.calls.size());
+            err = recordIt->second.result;
+            if (err == 0) ReplayPreLoadHook(ctxData.patchHistory, recordIt->second);
+        }
+        else
+        {
+            PreLoadHookRecord& record = gPreLoadHookRecords.records[recordKey];
+            ctxData.preLoadHookRecord = &record;
+            record.result             = DllPreLoadHook(&ctx, lpLibFileName);
+            ctxData.preLoadHookRecord = nullptr;
+            err                       = record.result;
+        }
+        gPreLoadHookRecords.used.push_back(recordKey);
+        if (err)
         {
             LOGW(L"DllPreLoadHook returned{}.\n", err);
             // TODO: Handle error?
@@ -204,7 +978,8 @@ bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE
     }
 
     PatchInformationFunctions patch;
-    if (!getPatchInformationFunctions(lpLibFileName, patch, hPatchModule))
+    GetPatchActionsTableType  GetPatchActionsTable = nullptr;
+    if (!getPatchInformationFunctions(lpLibFileName, patch, GetPatchActionsTable, hPatchModule))
     {
         if (!DllPreLoadHook)
         {
@@ -213,35 +988,78 @@ bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE
         }
         else { return true; }
     }
-    if (patch.GetLastOrdinal && patch.GetBaseOrdinal && patch.GetPatchAction)
+    const int baseOrdinal = patch.GetBaseOrdinal ? patch.GetBaseOrdinal() : 0;
+    const int lastOrdinal = patch.GetLastOrdinal ? patch.GetLastOrdinal() : -1;
+    if (lastOrdinal >= baseOrdinal && (patch.GetPatchAction || GetPatchActionsTable))
     {
-        ordinalDetouredAddresses.resize(patch.GetLastOrdinal() - patch.GetBaseOrdinal() + 1);
-        for (int ordinal = patch.GetBaseOrdinal(); ordinal <= patch.GetLastOrdinal(); ordinal++)
+        const size_t nbOrdinals               = size_t(lastOrdinal - baseOrdinal + 1);
+        PVOID* const ordinalDetouredAddresses = DetoursPatchTransactionAllocPointers(nbOrdinals);
+
+        // Gather the actions of every ordinal first, either as a whole or one by one for older patches.
+        const PatchAction*       patchActions = GetPatchActionsTable ? GetPatchActionsTable(lpLibFileName) : nullptr;
+        std::vector<PatchAction> patchActionsStorage;
+        if (!patchActions)
+        {
+            if (!patch.GetPatchAction)
+            {
+                LOGW(L"GetPatchActionsTable returned nullptr but GetPatchAction is not available.\n");
+                return false;
+            }
+            patchActionsStorage.resize(nbOrdinals);
+            for (size_t ordinalIndex = 0; ordinalIndex < nbOrdinals; ordinalIndex++)
+                patchActionsStorage[ordinalIndex] = patch.GetPatchAction(baseOrdinal + int(ordinalIndex));
+            patchActions = patchActionsStorage.data();
+        }
+
+        ModuleExports       originalExports(hOriginalModule);
+        const ModuleExports patchExports(hPatchModule);
+        size_t              nbNewOrdinalThunks = 0;
+        for (size_t ordinalIndex = 0; ordinalIndex < nbOrdinals; ordinalIndex++)
         {
-            const PatchAction patchAction = patch.GetPatchAction(ordinal);
+            const int         ordinal     = baseOrdinal + int(ordinalIndex);
+            const PatchAction patchAction = patchActions[ordinalIndex];
             if (patchAction == PatchAction::Ignore)
             {
-                LOGW(L"Ordinal {} ignored.\n", ordinal);
+                LOGW_VERBOSE(L"Ordinal {} ignored.\n", ordinal);
                 continue;
             }
 
-            PVOID originalOrdinalAddress = GetProcAddress(hOriginalModule, (LPCSTR)ordinal);
-            PVOID patchOrdinalAddress    = GetProcAddress(hPatchModule, (LPCSTR)ordinal);
+            PVOID originalOrdinalAddress = originalExports.GetOrdinalAddress(ordinal);
+            PVOID patchOrdinalAddress    = patchExports.GetOrdinalAddress(ordinal);
+            // Ordinals with a unique address are detoured in place, as usual.
+            if (gOrdinalThunks.enabled && originalOrdinalAddress && patchOrdinalAddress &&
+                patchAction == PatchAction::FunctionReplaceOriginalByPatch && originalExports.IsAliased(ordinal))
+            {
+                bool newThunk          = false;
+                originalOrdinalAddress = GetOrdinalThunk(hOriginalModule, ordinal, originalOrdinalAddress,
+                                                         hPatchModule, newThunk);
+                if (newThunk) nbNewOrdinalThunks++;
+            }
 
-            LOGW(L"Patching ordinal {} (origAddr {} {} patchAddr {}) \n", ordinal, originalOrdinalAddress,
-                 patchAction == PatchAction::FunctionReplaceOriginalByPatch ||
-                         patchAction == PatchAction::PointerReplaceOriginalByPatch
-                     ? L"<=="
-                     : L"==>",
-                 patchOrdinalAddress);
+            LOGW_VERBOSE(L"Patching ordinal {} (origAddr {} {} patchAddr {}) \n", ordinal, originalOrdinalAddress,
+                         patchAction == PatchAction::FunctionReplaceOriginalByPatch ||
+                                 patchAction == PatchAction::PointerReplaceOriginalByPatch ||
+                                 patchAction == PatchAction::ImportReplaceOriginalByPatch
+                             ? L"<=="
+                             : L"==>",
+                         patchOrdinalAddress);
             switch (ApplyPatchAction(ctxData.patchHistory, originalOrdinalAddress, patchOrdinalAddress, patchAction,
-                                     &ordinalDetouredAddresses[ordinal - patch.GetBaseOrdinal()]))
+                                     &ordinalDetouredAddresses[ordinalIndex]))
             {
             case PatchAction_BadInput: // FALLTHROUGH
             case PatchAction_PatchFailed: LOGW(L"Stop patching...\n"); return false;
             default: break;
             }
         }
+
+        // The callers of the loaded modules must go through the new thunks.
+        if (nbNewOrdinalThunks != 0)
+        {
+            size_t nbPatchedSlots = 0;
+            for (HMODULE hModule = nullptr; (hModule = DetourEnumerateModules(hModule)) != nullptr;)
+                nbPatchedSlots += PatchModuleImports(hModule);
+            LOGW(L"Patched {} imports to use {} ordinal thunks\n", nbPatchedSlots, nbNewOrdinalThunks);
+        }
     }
 
     const int nbExtraPatchActions = patch.GetExtraPatchActionsCount ? patch.GetExtraPatchActionsCount() : 0;
@@ -259,15 +1077,16 @@ bool DetoursPatchModule(LPCWSTR lpLibFileName, HMODULE hOriginalModule, HMODULE
 
         if (extraPatchAction->action == PatchAction::Ignore)
         {
-            LOGW(L"Ignoring patch offset {} patchAddr {}) \n", extraPatchAction->originalDllOffset, extraPatchAction->patchData);
+            LOGW_VERBOSE(L"Ignoring patch offset {} patchAddr {}) \n", extraPatchAction->originalDllOffset, extraPatchAction->patchData);
             continue;
         }
-        LOGW(L"Patching origAddr {} {} patchAddr {}) \n", originalAddress,
-             extraPatchAction->action == PatchAction::FunctionReplaceOriginalByPatch ||
-                     extraPatchAction->action == PatchAction::PointerReplaceOriginalByPatch
-                 ? L"<=="
-                 : L"==>",
-             extraPatchAction->patchData);
+        LOGW_VERBOSE(L"Patching origAddr {} {} patchAddr {}) \n", originalAddress,
+                     extraPatchAction->action == PatchAction::FunctionReplaceOriginalByPatch ||
+                             extraPatchAction->action == PatchAction::PointerReplaceOriginalByPatch ||
+                             extraPatchAction->action == PatchAction::ImportReplaceOriginalByPatch
+                         ? L"<=="
+                         : L"==>",
+                     extraPatchAction->patchData);
         switch (ApplyPatchAction(ctxData.patchHistory, originalAddress, extraPatchAction->patchData,
                                  extraPatchAction->action, realPatchedFunctionStorage))
         {
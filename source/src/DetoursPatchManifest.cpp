@@ -0,0 +1,122 @@
+#include "DetoursPatchManifest.h"
+#include "DetoursBinaryIO.h"
+#include "DetoursHash.h"
+#include "DetoursMappedFile.h"
+
+#include <cwctype>
+
+#define LOG_PREFIX "(DetoursPatchManifest):"
+#include "Log.h"
+
+// File layout (little endian):
+//   u32 magic, u32 version, u32 entriesCount
+//   entries: string dllName, u64 size, u64 lastWriteTime, u64 contentHash, u32 isPatch, u32 targetsCount, string targets[]
+//   where string is u32 length followed by length wchar_t
+static const uint32_t manifestMagic   = 'D2DM';
+static const uint32_t manifestVersion = 1;
+
+static std::wstring CaseFoldFileName(const wchar_t* fileName)
+{
+    std::wstring foldedName = fileName;
+    for (wchar_t& c : foldedName)
+        c = towlower(c);
+    return foldedName;
+}
+
+bool DetoursPatchManifest::Load()
+{
+    loadedEntries.clear();
+    usedEntries.clear();
+    modified = false;
+
+    DetoursMappedFile file(path.c_str());
+    if (!file) return false;
+
+    DetoursBinaryReader reader{file.data, file.data + file.size};
+    uint32_t            magic, version, entriesCount;
+    if (!reader.Read(magic) || !reader.Read(version) || !reader.Read(entriesCount) || magic != manifestMagic ||
+        version != manifestVersion)
+    {
+        LOGW(L"Ignoring invalid manifest {}\n", path);
+        return false;
+    }
+
+    for (uint32_t entryIndex = 0; entryIndex < entriesCount; entryIndex++)
+    {
+        std::wstring dllName;
+        Entry        entry;
+        uint32_t     isPatch, targetsCount;
+        if (!reader.Read(dllName) || !reader.Read(entry.key.size) || !reader.Read(entry.key.lastWriteTime) ||
+            !reader.Read(entry.key.contentHash) || !reader.Read(isPatch) || !reader.Read(targetsCount))
+        {
+            LOGW(L"Ignoring truncated manifest {}\n", path);
+            loadedEntries.clear();
+            return false;
+        }
+        entry.isPatch = isPatch != 0;
+        entry.targetModules.resize(targetsCount);
+        for (std::wstring& targetModule : entry.targetModules)
+        {
+            if (!reader.Read(targetModule))
+            {
+                LOGW(L"Ignoring truncated manifest {}\n", path);
+                loadedEntries.clear();
+                return false;
+            }
+        }
+        loadedEntries[CaseFoldFileName(dllName.c_str())] = std::move(entry);
+    }
+    return true;
+}
+
+bool DetoursPatchManifest::SaveIfModified()
+{
+    // Entries of dlls that were removed from the folder are dropped
+    if (!modified && usedEntries.size() == loadedEntries.size()) return true;
+
+    DetoursBinaryWriter writer;
+    writer.Write(manifestMagic);
+    writer.Write(manifestVersion);
+    writer.Write(uint32_t(usedEntries.size()));
+    for (const auto& dllNameAndEntry : usedEntries)
+    {
+        const Entry& entry = dllNameAndEntry.second;
+        writer.Write(dllNameAndEntry.first);
+        writer.Write(entry.key.size);
+        writer.Write(entry.key.lastWriteTime);
+        writer.Write(entry.key.contentHash);
+        writer.Write(uint32_t(entry.isPatch));
+        writer.Write(uint32_t(entry.targetModules.size()));
+        for (const std::wstring& targetModule : entry.targetModules)
+            writer.Write(targetModule);
+    }
+
+    if (!DetoursWriteFileAtomically(path, writer.buffer)) return false;
+    modified = false;
+    return true;
+}
+
+bool DetoursPatchManifest::ComputeFileKey(const wchar_t* fullDllPath, const WIN32_FIND_DATAW& findData, FileKey& key)
+{
+    DetoursMappedFile file(fullDllPath);
+    if (!file) return false;
+    key.size          = (uint64_t(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+    key.lastWriteTime = (uint64_t(findData.ftLastWriteTime.dwHighDateTime) << 32) |
+                        findData.ftLastWriteTime.dwLowDateTime;
+    key.contentHash   = DetoursHash64(file.data, file.size);
+    return true;
+}
+
+const DetoursPatchManifest::Entry* DetoursPatchManifest::Find(const wchar_t* dllName, const FileKey& key)
+{
+    const auto entryIt = loadedEntries.find(CaseFoldFileName(dllName));
+    if (entryIt == loadedEntries.end() || !(entryIt->second.key == key)) return nullptr;
+    usedEntries.emplace_back(dllName, entryIt->second);
+    return &usedEntries.back().second;
+}
+
+void DetoursPatchManifest::Store(const wchar_t* dllName, Entry entry)
+{
+    usedEntries.emplace_back(dllName, std::move(entry));
+    modified = true;
+}
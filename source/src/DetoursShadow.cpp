@@ -0,0 +1,52 @@
+#include "DetoursShadow.h"
+
+#include <Windows.h>
+
+#define LOG_PREFIX "(DetoursShadow):"
+#include "Log.h"
+
+static uint32_t ReadShadowSampleRate()
+{
+    wchar_t     envValue[16];
+    const DWORD envValueLen = GetEnvironmentVariableW(L"DIABLO2_PATCH_SHADOW_RATE", envValue, _countof(envValue));
+    if (envValueLen == 0 || envValueLen >= _countof(envValue)) return 0;
+    const long sampleRate = wcstol(envValue, nullptr, 10);
+    return sampleRate > 0 ? uint32_t(sampleRate) : 0;
+}
+
+static uint32_t ShadowSampleRate()
+{
+    static const uint32_t sampleRate = ReadShadowSampleRate();
+    return sampleRate;
+}
+
+DetoursShadowSite::DetoursShadowSite(int siteOrdinal) : DetoursShadowSite(siteOrdinal, ShadowSampleRate()) {}
+
+void DetoursShadowSite::LogMismatch(uint64_t mismatchIndex, const std::vector<uint8_t>& inputs,
+                                    DetoursShadowMemory memory, const void* originalResult,
+                                    const void* replacementResult, size_t resultSize) const
+{
+    // Raw bytes, so that the call can be replayed offline. A full palette takes several lines, see
+    // detoursShadowBytesPerLine.
+    for (const std::string& line : DetoursShadowMismatchLines(ordinal, mismatchIndex, inputs, memory, originalResult,
+                                                              replacementResult, resultSize))
+        LOG("{}", line);
+    if (mismatchIndex + 1 == maxLoggedMismatches) LOG("Ordinal {}: further mismatches will not be logged\n", ordinal);
+}
+
+void DetoursDumpShadowStats()
+{
+    bool hasSamples = false;
+    for (DetoursShadowSite* site = DetoursShadowSite::List().load(std::memory_order_acquire); site; site = site->next)
+    {
+        const uint64_t samples = site->GetNbSamples();
+        if (samples == 0 && site->GetNbSkipped() == 0) continue;
+        if (!hasSamples) LOG("Shadow execution, the time of the replacement is relative to the original function:\n");
+        hasSamples = true;
+        const uint64_t originalCycles    = site->totalOriginalCycles.load(std::memory_order_relaxed);
+        const uint64_t replacementCycles = site->totalReplacementCycles.load(std::memory_order_relaxed);
+        LOG(" Ordinal {}: {} samples, {} mismatches, {} skipped, {:.3f}x the time\n", site->ordinal, samples,
+            site->GetNbMismatches(), site->GetNbSkipped(),
+            originalCycles ? double(replacementCycles) / double(originalCycles) : 0.0);
+    }
+}
@@ -0,0 +1,108 @@
+#include "DetoursSignatureCache.h"
+#include "DetoursBinaryIO.h"
+#include "DetoursHash.h"
+#include "DetoursMappedFile.h"
+
+#include <cassert>
+
+#define LOG_PREFIX "(DetoursSignatureCache):"
+#include "Log.h"
+
+// File layout (little endian):
+//   u32 magic, u32 version, u32 entriesCount
+//   entries: u32 timeDateStamp, u32 checkSum, u32 sizeOfImage, u64 patternHash, u32 nbMatches, u32 offsetsCount,
+//            u32 offsets[]
+static const uint32_t cacheMagic   = 'D2DS';
+static const uint32_t cacheVersion = 1;
+
+uint64_t DetoursSignatureCache::EntryId(const ModuleKey& module, uint64_t patternHash)
+{
+    const uint32_t moduleFields[] = {module.timeDateStamp, module.checkSum, module.sizeOfImage};
+    return DetoursHash64(moduleFields, sizeof(moduleFields), patternHash);
+}
+
+bool DetoursSignatureCache::Load()
+{
+    entries.clear();
+    modified = false;
+
+    DetoursMappedFile file(path.c_str());
+    if (!file) return false;
+
+    DetoursBinaryReader reader{file.data, file.data + file.size};
+    uint32_t            magic, version, entriesCount;
+    if (!reader.Read(magic) || !reader.Read(version) || !reader.Read(entriesCount) || magic != cacheMagic ||
+        version != cacheVersion)
+    {
+        LOGW(L"Ignoring invalid signature cache {}\n", path);
+        return false;
+    }
+
+    for (uint32_t entryIndex = 0; entryIndex < entriesCount; entryIndex++)
+    {
+        Entry    entry;
+        uint32_t offsetsCount;
+        if (!reader.Read(entry.module.timeDateStamp) || !reader.Read(entry.module.checkSum) ||
+            !reader.Read(entry.module.sizeOfImage) || !reader.Read(entry.patternHash) || !reader.Read(entry.nbMatches) ||
+            !reader.Read(offsetsCount) || offsetsCount > maxCachedOffsets || offsetsCount > entry.nbMatches)
+        {
+            LOGW(L"Ignoring truncated signature cache {}\n", path);
+            entries.clear();
+            return false;
+        }
+        entry.offsets.resize(offsetsCount);
+        if (offsetsCount && !reader.Read(entry.offsets.data(), offsetsCount * sizeof(uint32_t)))
+        {
+            LOGW(L"Ignoring truncated signature cache {}\n", path);
+            entries.clear();
+            return false;
+        }
+        const uint64_t entryId = EntryId(entry.module, entry.patternHash);
+        entries[entryId]       = std::move(entry);
+    }
+    return true;
+}
+
+bool DetoursSignatureCache::SaveIfModified()
+{
+    if (!modified) return true;
+
+    DetoursBinaryWriter writer;
+    writer.Write(cacheMagic);
+    writer.Write(cacheVersion);
+    writer.Write(uint32_t(entries.size()));
+    for (const auto& idAndEntry : entries)
+    {
+        const Entry& entry = idAndEntry.second;
+        writer.Write(entry.module.timeDateStamp);
+        writer.Write(entry.module.checkSum);
+        writer.Write(entry.module.sizeOfImage);
+        writer.Write(entry.patternHash);
+        writer.Write(entry.nbMatches);
+        writer.Write(uint32_t(entry.offsets.size()));
+        writer.Write(entry.offsets.data(), entry.offsets.size() * sizeof(uint32_t));
+    }
+
+    if (!DetoursWriteFileAtomically(path, writer.buffer)) return false;
+    modified = false;
+    return true;
+}
+
+const DetoursSignatureCache::Entry* DetoursSignatureCache::Find(const ModuleKey& module, uint64_t patternHash) const
+{
+    const auto entryIt = entries.find(EntryId(module, patternHash));
+    if (entryIt == entries.end()) return nullptr;
+    const Entry& entry = entryIt->second;
+    if (entry.module.timeDateStamp != module.timeDateStamp || entry.module.checkSum != module.checkSum ||
+        entry.module.sizeOfImage != module.sizeOfImage || entry.patternHash != patternHash)
+        return nullptr;
+    return &entry;
+}
+
+void DetoursSignatureCache::Store(Entry entry)
+{
+    assert(entry.offsets.size() <= maxCachedOffsets);
+    const uint64_t entryId = EntryId(entry.module, entry.patternHash);
+    entries[entryId]       = std::move(entry);
+    modified               = true;
+}
@@ -0,0 +1,185 @@
+#include "DetoursSignatureScan.h"
+#include "DetoursCpuFeatures.h"
+#include "DetoursHash.h"
+
+#include <algorithm>
+#include <cstring>
+
+static int HexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool DetoursSignature::Parse(const char* pattern)
+{
+    bytes.clear();
+    mask.clear();
+    for (const char* c = pattern; *c;)
+    {
+        if (*c == ' ')
+        {
+            c++;
+            continue;
+        }
+        if (*c == '?')
+        {
+            c += (c[1] == '?') ? 2 : 1;
+            bytes.push_back(0);
+            mask.push_back(0);
+        }
+        else
+        {
+            const int high = HexDigitValue(c[0]);
+            const int low  = high < 0 ? -1 : HexDigitValue(c[1]);
+            if (low < 0) return false;
+            c += 2;
+            bytes.push_back(uint8_t(high << 4 | low));
+            mask.push_back(0xFF);
+        }
+        // Tokens must be separated
+        if (*c != ' ' && *c != '\0') return false;
+    }
+    if (bytes.empty()) return false;
+
+    const size_t patternSize = bytes.size();
+    hasAnchor                = false;
+    for (size_t i = 0; i < patternSize; i++)
+    {
+        if (!mask[i]) continue;
+        if (!hasAnchor) firstAnchor = i;
+        lastAnchor = i;
+        hasAnchor  = true;
+    }
+
+    // A wildcard matches any byte, so it limits the shift of every byte value.
+    std::fill(std::begin(shifts), std::end(shifts), patternSize);
+    for (size_t i = 0; i + 1 < patternSize; i++)
+    {
+        if (mask[i]) shifts[bytes[i]] = patternSize - 1 - i;
+        else std::fill(std::begin(shifts), std::end(shifts), patternSize - 1 - i);
+    }
+    return true;
+}
+
+static bool MatchesAt(const uint8_t* data, const uint8_t* bytes, const uint8_t* mask, size_t patternSize)
+{
+    for (size_t i = 0; i < patternSize; i++)
+    {
+        if ((data[i] & mask[i]) != bytes[i]) return false;
+    }
+    return true;
+}
+
+size_t DetoursSignature::Find(const uint8_t* data, size_t size, size_t start) const
+{
+    if (bytes.empty() || size < bytes.size() || start > size - bytes.size()) return size;
+    if (!hasAnchor) return start;
+#if DETOURS_X86_SIMD
+    if (DetoursCpuSupportsAVX2()) return FindAVX2(data, size, start);
+    return FindSSE2(data, size, start);
+#else
+    return FindHorspool(data, size, start);
+#endif
+}
+
+bool DetoursSignature::Matches(const uint8_t* data) const
+{
+    return MatchesAt(data, bytes.data(), mask.data(), bytes.size());
+}
+
+uint64_t DetoursSignature::Hash() const
+{
+    return DetoursHash64(bytes.data(), bytes.size(), DetoursHash64(mask.data(), mask.size()));
+}
+
+size_t DetoursSignature::FindHorspool(const uint8_t* data, size_t size, size_t start) const
+{
+    const size_t patternSize = bytes.size();
+    for (size_t pos = start; pos <= size - patternSize;)
+    {
+        if (MatchesAt(data + pos, bytes.data(), mask.data(), patternSize)) return pos;
+        pos += shifts[data[pos + patternSize - 1]];
+    }
+    return size;
+}
+
+#if DETOURS_X86_SIMD
+
+// Both kernels compare the anchors of `blockSize` consecutive candidate positions at once, and only verify the whole
+// pattern for the positions where both anchors match. The remaining positions are handled by FindHorspool.
+
+size_t DetoursSignature::FindSSE2(const uint8_t* data, size_t size, size_t start) const
+{
+    const size_t  patternSize = bytes.size();
+    const size_t  blockSize   = 16;
+    const __m128i first       = _mm_set1_epi8(char(bytes[firstAnchor]));
+    const __m128i last        = _mm_set1_epi8(char(bytes[lastAnchor]));
+
+    size_t pos = start;
+    // Loads read [pos + anchor, pos + anchor + blockSize), and candidates must leave room for the pattern.
+    for (; pos + std::max(lastAnchor + blockSize, patternSize + blockSize - 1) <= size; pos += blockSize)
+    {
+        const __m128i firstBlock = _mm_loadu_si128((const __m128i*)(data + pos + firstAnchor));
+        const __m128i lastBlock  = _mm_loadu_si128((const __m128i*)(data + pos + lastAnchor));
+        unsigned      candidates = unsigned(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstBlock, first), _mm_cmpeq_epi8(lastBlock, last))));
+        while (candidates)
+        {
+            unsigned long bit;
+#ifdef _MSC_VER
+            _BitScanForward(&bit, candidates);
+#else
+            bit = unsigned(__builtin_ctz(candidates));
+#endif
+            if (MatchesAt(data + pos + bit, bytes.data(), mask.data(), patternSize)) return pos + bit;
+            candidates &= candidates - 1;
+        }
+    }
+    return FindHorspool(data, size, pos);
+}
+
+DETOURS_TARGET_AVX2 size_t DetoursSignature::FindAVX2(const uint8_t* data, size_t size, size_t start) const
+{
+    const size_t  patternSize = bytes.size();
+    const size_t  blockSize   = 32;
+    const __m256i first       = _mm256_set1_epi8(char(bytes[firstAnchor]));
+    const __m256i last        = _mm256_set1_epi8(char(bytes[lastAnchor]));
+
+    size_t pos = start;
+    for (; pos + std::max(lastAnchor + blockSize, patternSize + blockSize - 1) <= size; pos += blockSize)
+    {
+        const __m256i firstBlock = _mm256_loadu_si256((const __m256i*)(data + pos + firstAnchor));
+        const __m256i lastBlock  = _mm256_loadu_si256((const __m256i*)(data + pos + lastAnchor));
+        unsigned      candidates = unsigned(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(firstBlock, first), _mm256_cmpeq_epi8(lastBlock, last))));
+        while (candidates)
+        {
+            unsigned long bit;
+#ifdef _MSC_VER
+            _BitScanForward(&bit, candidates);
+#else
+            bit = unsigned(__builtin_ctz(candidates));
+#endif
+            if (MatchesAt(data + pos + bit, bytes.data(), mask.data(), patternSize)) return pos + bit;
+            candidates &= candidates - 1;
+        }
+    }
+    return FindHorspool(data, size, pos);
+}
+
+#else
+
+size_t DetoursSignature::FindSSE2(const uint8_t* data, size_t size, size_t start) const
+{
+    return FindHorspool(data, size, start);
+}
+
+size_t DetoursSignature::FindAVX2(const uint8_t* data, size_t size, size_t start) const
+{
+    return FindHorspool(data, size, start);
+}
+
+#endif
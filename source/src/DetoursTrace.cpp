@@ -0,0 +1,151 @@
+#include "DetoursTrace.h"
+#include "DetoursBinaryIO.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <cwchar>
+#include <fmt/format.h>
+#include <string>
+
+#define LOG_PREFIX "(DetoursTrace):"
+#include "Log.h"
+
+namespace
+{
+struct TraceEvent
+{
+    const char* name;
+    wchar_t     detail[64];
+    int64_t     start;
+    int64_t     duration;
+    DWORD       threadId;
+    // Events are reserved before being filled, and may be written while the file is being written
+    std::atomic<bool> recorded;
+};
+
+const size_t maxTraceEvents = 4096;
+
+struct TraceState
+{
+    TraceState()
+    {
+        const DWORD pathLength = GetEnvironmentVariableW(DETOURS_TRACE_FILE_ENV, path, MAX_PATH);
+        enabled                = pathLength != 0 && pathLength < MAX_PATH;
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        ticksPerMicrosecond = double(frequency.QuadPart) / 1e6;
+    }
+
+    bool                enabled = false;
+    wchar_t             path[MAX_PATH];
+    double              ticksPerMicrosecond = 1.0;
+    std::atomic<size_t> nbEvents{0};
+    TraceEvent          events[maxTraceEvents];
+};
+TraceState traceState;
+
+int64_t ReadTicks()
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+void RecordEvent(const char* name, const wchar_t* detail, int64_t start, int64_t end)
+{
+    const size_t eventIndex = traceState.nbEvents.fetch_add(1, std::memory_order_relaxed);
+    if (eventIndex >= maxTraceEvents) return;
+
+    TraceEvent& event = traceState.events[eventIndex];
+    event.name        = name;
+    event.start       = start;
+    event.duration    = end - start;
+    event.threadId    = GetCurrentThreadId();
+    event.detail[0]   = L'\0';
+    if (detail)
+    {
+        const wchar_t* fileName = detail;
+        for (const wchar_t* c = detail; *c; c++)
+        {
+            if (*c == L'\\' || *c == L'/') fileName = c + 1;
+        }
+        wcsncpy(event.detail, fileName, _countof(event.detail) - 1);
+        event.detail[_countof(event.detail) - 1] = L'\0';
+    }
+    event.recorded.store(true, std::memory_order_release);
+}
+
+void AppendJsonString(std::string& json, const wchar_t* str)
+{
+    json += '"';
+    for (const wchar_t* c = str; *c; c++)
+    {
+        if (*c == L'"' || *c == L'\\') json += '\\';
+        // Dll names are expected to be ASCII, anything else is replaced to keep the JSON valid.
+        json += (*c >= 0x20 && *c < 0x7F) ? char(*c) : '?';
+    }
+    json += '"';
+}
+} // namespace
+
+DetoursTraceScope::DetoursTraceScope(const char* scopeName, const wchar_t* scopeDetail)
+    : name(scopeName), detail(scopeDetail), start(traceState.enabled ? ReadTicks() : 0)
+{
+}
+
+DetoursTraceScope::~DetoursTraceScope()
+{
+    if (traceState.enabled) RecordEvent(name, detail, start, ReadTicks());
+}
+
+void DetoursTraceWrite()
+{
+    if (!traceState.enabled) return;
+
+    // The launcher tells us when it started creating the process, which ends when the first event starts.
+    wchar_t launchTimeStr[32];
+    if (GetEnvironmentVariableW(DETOURS_TRACE_LAUNCH_TIME_ENV, launchTimeStr, _countof(launchTimeStr)) != 0 &&
+        traceState.nbEvents.load() != 0)
+    {
+        int64_t firstEventStart = INT64_MAX;
+        for (size_t eventIndex = 0; eventIndex < std::min(traceState.nbEvents.load(), maxTraceEvents); eventIndex++)
+        {
+            const TraceEvent& event = traceState.events[eventIndex];
+            if (event.recorded.load(std::memory_order_acquire)) firstEventStart = std::min(firstEventStart, event.start);
+        }
+        const int64_t launchTime = _wcstoi64(launchTimeStr, nullptr, 10);
+        // Only record it once, as the file may be written multiple times
+        SetEnvironmentVariableW(DETOURS_TRACE_LAUNCH_TIME_ENV, nullptr);
+        if (launchTime > 0 && firstEventStart != INT64_MAX && launchTime < firstEventStart)
+            RecordEvent("Process creation (launcher)", nullptr, launchTime, firstEventStart);
+    }
+
+    const size_t nbEvents     = std::min(traceState.nbEvents.load(), maxTraceEvents);
+    const DWORD  pid          = GetCurrentProcessId();
+    std::string  json         = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool         isFirstEvent = true;
+    for (size_t eventIndex = 0; eventIndex < nbEvents; eventIndex++)
+    {
+        const TraceEvent& event = traceState.events[eventIndex];
+        if (!event.recorded.load(std::memory_order_acquire)) continue;
+        if (!isFirstEvent) json += ",\n";
+        isFirstEvent = false;
+        json += fmt::format("{{\"name\":\"{}\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},"
+                            "\"pid\":{},\"tid\":{}",
+                            event.name, double(event.start) / traceState.ticksPerMicrosecond,
+                            double(event.duration) / traceState.ticksPerMicrosecond, pid, event.threadId);
+        if (event.detail[0])
+        {
+            json += ",\"args\":{\"dll\":";
+            AppendJsonString(json, event.detail);
+            json += '}';
+        }
+        json += '}';
+    }
+    json += "\n]}\n";
+
+    if (traceState.nbEvents.load() > maxTraceEvents)
+        LOG("Trace buffer full, {} events were dropped.\n", traceState.nbEvents.load() - maxTraceEvents);
+    DetoursWriteFileAtomically(traceState.path, std::vector<uint8_t>(json.begin(), json.end()));
+}
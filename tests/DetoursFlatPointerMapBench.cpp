@@ -0,0 +1,53 @@
+// DetoursFlatPointerMap against std::unordered_map, the container the patch history used before, with as many
+// entries as a large set of patches and the same capacity as the history.
+#include "DetoursFlatPointerMap.h"
+#include "DetoursTest.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+int main()
+{
+    const size_t nbKeys = 4000, nbLookups = 4000000;
+    std::vector<void*> keys;
+    DetoursTestRandom  random(42);
+    for (size_t keyIndex = 0; keyIndex < nbKeys; keyIndex++)
+        keys.push_back((void*)(uintptr_t(0x6FA00000) + uintptr_t(random.Below(0x100000)) * 16));
+    // Lookups mostly hit, as when checking whether an address was already patched
+    std::vector<void*> lookups;
+    for (size_t lookupIndex = 0; lookupIndex < nbLookups; lookupIndex++)
+        lookups.push_back(random.Below(8) == 0 ? (void*)uintptr_t(random.Next() & ~uint64_t(15)) : keys[random.Below(nbKeys)]);
+
+    // Too large for the stack
+    std::unique_ptr<DetoursFlatPointerMap<1 << 14>> flatMap(new DetoursFlatPointerMap<1 << 14>());
+    std::unordered_map<void*, void*>               unorderedMap;
+
+    const size_t nbRounds = 100;
+    const double flatInsertNs = DetoursBenchNanoseconds(nbRounds, [&](size_t) {
+        flatMap.reset(new DetoursFlatPointerMap<1 << 14>());
+        bool inserted;
+        for (void* key : keys)
+            flatMap->Insert(key, key, inserted);
+    }) / nbKeys;
+    const double unorderedInsertNs = DetoursBenchNanoseconds(nbRounds, [&](size_t) {
+        unorderedMap = {};
+        for (void* key : keys)
+            unorderedMap.emplace(key, key);
+    }) / nbKeys;
+    DETOURS_CHECK(flatMap->Size() == unorderedMap.size());
+
+    const double flatFindNs = DetoursBenchNanoseconds(nbLookups, [&](size_t lookupIndex) {
+        DetoursDoNotOptimize(flatMap->Find(lookups[lookupIndex]) != nullptr);
+    });
+    const double unorderedFindNs = DetoursBenchNanoseconds(nbLookups, [&](size_t lookupIndex) {
+        DetoursDoNotOptimize(unorderedMap.find(lookups[lookupIndex]) != unorderedMap.end());
+    });
+
+    std::printf("%zu pointer keys:\n", unorderedMap.size());
+    std::printf("  insert, DetoursFlatPointerMap: %8.1f ns\n", flatInsertNs);
+    std::printf("  insert, std::unordered_map:    %8.1f ns\n", unorderedInsertNs);
+    std::printf("  find,   DetoursFlatPointerMap: %8.1f ns\n", flatFindNs);
+    std::printf("  find,   std::unordered_map:    %8.1f ns\n", unorderedFindNs);
+    return 0;
+}
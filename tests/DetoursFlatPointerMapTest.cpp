@@ -0,0 +1,78 @@
+// DetoursFlatPointerMap against std::unordered_map, with random inserts, lookups and erasures on small maps so that
+// probe sequences are long and wrap around the end of the table.
+#include "DetoursFlatPointerMap.h"
+#include "DetoursTest.h"
+
+#include <unordered_map>
+
+template<size_t Capacity>
+static void CheckAgainstUnorderedMap(uint64_t seed, size_t nbOperations, uint32_t keyRange)
+{
+    DetoursFlatPointerMap<Capacity>   map;
+    std::unordered_map<void*, void*>  reference;
+    DetoursTestRandom                 random(seed);
+    const auto randomKey = [&] {
+        // Aligned addresses in a small range, as the patched addresses of a module, so that keys collide.
+        return (void*)(uintptr_t(0x6FA00000) + uintptr_t(1 + random.Below(keyRange)) * 16);
+    };
+
+    for (size_t operation = 0; operation < nbOperations; operation++)
+    {
+        void* const key = randomKey();
+        switch (random.Below(3))
+        {
+        case 0:
+        {
+            void* const value    = (void*)uintptr_t(random.Next());
+            bool        inserted = false;
+            auto*       entry    = map.Insert(key, value, inserted);
+            const auto  it       = reference.find(key);
+            if (it != reference.end())
+            {
+                // Existing entries are returned as is
+                DETOURS_CHECK(entry && !inserted && entry->key == key && entry->value == it->second);
+            }
+            else if (reference.size() == DetoursFlatPointerMap<Capacity>::maxEntries)
+            {
+                DETOURS_CHECK(!entry && !inserted);
+            }
+            else
+            {
+                DETOURS_CHECK(entry && inserted && entry->key == key && entry->value == value);
+                reference.emplace(key, value);
+            }
+            break;
+        }
+        case 1:
+            DETOURS_CHECK(map.Erase(key) == (reference.erase(key) == 1));
+            break;
+        default:
+        {
+            const auto* entry = map.Find(key);
+            const auto  it    = reference.find(key);
+            DETOURS_CHECK((entry != nullptr) == (it != reference.end()));
+            DETOURS_CHECK(!entry || entry->value == it->second);
+            break;
+        }
+        }
+        DETOURS_CHECK(map.Size() == reference.size());
+    }
+    // Every remaining entry must still be reachable after all the erasures.
+    for (const auto& keyValue : reference)
+    {
+        const auto* entry = map.Find(keyValue.first);
+        DETOURS_CHECK(entry && entry->value == keyValue.second);
+    }
+}
+
+int main()
+{
+    // More keys than the map can hold, so that it is often full
+    CheckAgainstUnorderedMap<16>(1, 100000, 24);
+    CheckAgainstUnorderedMap<64>(2, 200000, 64);
+    // Fewer keys, the map is often almost empty
+    CheckAgainstUnorderedMap<64>(3, 200000, 20);
+    CheckAgainstUnorderedMap<1 << 10>(4, 500000, 1000);
+    std::printf("DetoursFlatPointerMapTest passed\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Order in which the handlers of a DetoursHookChain are called, and what is reachable before, after and without a
+// commit. The jump stub is replaced by its jump target, which the test calls through like the stub would.
+#include "DetoursHookChain.h"
+#include "DetoursJumpStub.h"
+#include "DetoursTest.h"
+
+#include <string>
+
+void* DetoursAllocateJumpStub(void* const volatile* jumpTarget) { return (void*)jumpTarget; }
+
+using Function = void (*)(std::string& calls);
+
+static Function CallThroughStub(const DetoursHookChain& chain) { return *(Function const volatile*)chain.GetStub(); }
+
+static void Trampoline(std::string& calls) { calls += 'T'; }
+
+// Handlers log their name then continue the chain, except D which never does and thus has no storage.
+static void* nextA;
+static void* nextB;
+static void* nextC;
+static void  HandlerA(std::string& calls) { calls += 'A', Function(nextA)(calls); }
+static void  HandlerB(std::string& calls) { calls += 'B', Function(nextB)(calls); }
+static void  HandlerC(std::string& calls) { calls += 'C', Function(nextC)(calls); }
+static void  HandlerD(std::string& calls) { calls += 'D'; }
+
+static std::string Call(const DetoursHookChain& chain)
+{
+    std::string calls;
+    CallThroughStub(chain)(calls);
+    return calls;
+}
+
+int main()
+{
+    static int originalFunction;
+    DetoursHookChain* const chain = DetoursHookChain::Create(&originalFunction);
+    DETOURS_CHECK(chain && chain->GetOriginalFunction() == &originalFunction);
+    chain->SetTrampoline((void*)&Trampoline);
+    DETOURS_CHECK(Call(*chain) == "T");
+
+    // Pending handlers are not reachable until the commit.
+    chain->AddPending((void*)&HandlerA, 0, &nextA);
+    chain->AddPending((void*)&HandlerB, 5, &nextB);
+    DETOURS_CHECK(chain->Contains((void*)&HandlerA) && !chain->HasCommittedHandlers());
+    DETOURS_CHECK(Call(*chain) == "T");
+    chain->Commit();
+    DETOURS_CHECK(chain->HasCommittedHandlers() && chain->GetNbHandlers() == 2);
+    DETOURS_CHECK(Call(*chain) == "BAT");
+
+    // Same priority as A, so called after it. An aborted handler leaves the chain as it was.
+    chain->AddPending((void*)&HandlerC, 0, &nextC);
+    chain->Abort();
+    DETOURS_CHECK(!chain->Contains((void*)&HandlerC) && chain->GetNbHandlers() == 2);
+    DETOURS_CHECK(Call(*chain) == "BAT");
+    chain->AddPending((void*)&HandlerC, 0, &nextC);
+    chain->Commit();
+    DETOURS_CHECK(Call(*chain) == "BACT");
+
+    // A handler that does not continue the chain hides the ones with a lower priority, and the trampoline.
+    chain->AddPending((void*)&HandlerD, 1, nullptr);
+    chain->Commit();
+    DETOURS_CHECK(Call(*chain) == "BD");
+    DETOURS_CHECK(nextB == (void*)&HandlerD && nextA == (void*)&HandlerC && nextC == (void*)&Trampoline);
+
+    // Setting the trampoline again, as after a retried transaction, does not unlink committed handlers.
+    chain->SetTrampoline((void*)&Trampoline);
+    DETOURS_CHECK(Call(*chain) == "BD");
+
+    std::printf("DetoursHookChainTest passed\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Cost of DetoursHookStats::Record, which owner threads update with a relaxed load and store, against the same
+// counters updated with fetch_add as before. Run with one thread then four, every thread owning its slot: slots are
+// given once per thread, and only the first maxThreadSlots - 1 threads get one.
+#include "DetoursHookStats.h"
+#include "DetoursTest.h"
+
+#include <thread>
+#include <vector>
+
+// Previous layout, where every thread used fetch_add, even on the slot it is the only one to write to.
+struct alignas(64) FetchAddSlot
+{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> totalCycles{0};
+    std::atomic<uint32_t> histogram[DetoursHookStats::nbHistogramBuckets] = {};
+
+    void Record(uint64_t cycles)
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        totalCycles.fetch_add(cycles, std::memory_order_relaxed);
+        unsigned bucket = 0;
+        while (cycles > 1 && bucket + 1 < DetoursHookStats::nbHistogramBuckets)
+        {
+            cycles >>= 1;
+            bucket++;
+        }
+        histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+static DetoursHookStats stats(1);
+static FetchAddSlot     fetchAddSlots[DetoursHookStats::maxThreadSlots];
+
+// Average time per record of nbThreads threads recording at the same time.
+template<class Record>
+static double BenchThreads(unsigned nbThreads, const Record& record)
+{
+    const size_t        nbRecords = 50000000;
+    std::vector<double> threadNs(nbThreads);
+    std::vector<std::thread> threads;
+    for (unsigned threadIndex = 0; threadIndex < nbThreads; threadIndex++)
+    {
+        threads.emplace_back([&, threadIndex] {
+            threadNs[threadIndex] = DetoursBenchNanoseconds(nbRecords, [&](size_t index) {
+                record(threadIndex, 16 + (index & 0xFF));
+            });
+        });
+    }
+    double totalNs = 0;
+    for (unsigned threadIndex = 0; threadIndex < nbThreads; threadIndex++)
+    {
+        threads[threadIndex].join();
+        totalNs += threadNs[threadIndex];
+    }
+    return totalNs / nbThreads;
+}
+
+int main()
+{
+    const auto recordStats    = [](unsigned, uint64_t cycles) { stats.Record(cycles); };
+    const auto recordFetchAdd = [](unsigned threadIndex, uint64_t cycles) { fetchAddSlots[threadIndex].Record(cycles); };
+
+    std::printf("DetoursHookStats::Record, per call:\n");
+    for (unsigned nbThreads : {1u, 4u})
+    {
+        const double storeNs    = BenchThreads(nbThreads, recordStats);
+        const double fetchAddNs = BenchThreads(nbThreads, recordFetchAdd);
+        std::printf("  %u thread(s): load/store %5.2f ns, fetch_add %5.2f ns\n", nbThreads, storeNs, fetchAddNs);
+    }
+    return 0;
+}
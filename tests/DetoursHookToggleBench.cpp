@@ -0,0 +1,50 @@
+// Per call overhead of the stub of a DetoursHookToggle, enabled and disabled, compared with calling the patch function
+// or the original function directly. This runs the real stub, which is x86 code, so it is only built for 32bit Windows.
+#include "DetoursHookToggle.h"
+#include "DetoursTest.h"
+
+#include <Windows.h>
+
+static __declspec(noinline) int __cdecl OriginalFunction(int value) { return value * 5 + 2; }
+static __declspec(noinline) int __cdecl PatchFunction(int value) { return value * 3 + 1; }
+
+using Function = int(__cdecl*)(int);
+
+// Read on every call, as the callers of a detoured function can not know where it jumps.
+static Function volatile calledFunction;
+
+static double CallThroughPointer(size_t nbCalls)
+{
+    int result = 0;
+    const double ns = DetoursBenchNanoseconds(nbCalls, [&](size_t index) { result += calledFunction(int(index)); });
+    DetoursDoNotOptimize(result);
+    return ns;
+}
+
+int main()
+{
+    DetoursHookToggle* const toggle = DetoursHookToggle::Create((void*)&OriginalFunction, (void*)&PatchFunction);
+    DETOURS_CHECK(toggle != nullptr);
+    // Stands for the Detours trampoline, which runs the original code.
+    toggle->SetTrampoline((void*)&OriginalFunction);
+
+    const size_t nbCalls = 200000000;
+    calledFunction       = (Function)toggle->GetStub();
+    DETOURS_CHECK(calledFunction(2) == PatchFunction(2));
+    const double enabledNs = CallThroughPointer(nbCalls);
+    toggle->SetEnabled(false);
+    DETOURS_CHECK(calledFunction(2) == OriginalFunction(2));
+    const double disabledNs = CallThroughPointer(nbCalls);
+
+    calledFunction          = &PatchFunction;
+    const double patchNs    = CallThroughPointer(nbCalls);
+    calledFunction          = &OriginalFunction;
+    const double originalNs = CallThroughPointer(nbCalls);
+
+    std::printf("Call to a toggleable hook:\n");
+    std::printf("  Enabled stub:               %6.2f ns (%+.2f ns)\n", enabledNs, enabledNs - patchNs);
+    std::printf("  Patch function directly:    %6.2f ns\n", patchNs);
+    std::printf("  Disabled stub:              %6.2f ns (%+.2f ns)\n", disabledNs, disabledNs - originalNs);
+    std::printf("  Original function directly: %6.2f ns\n", originalNs);
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Per call overhead of the two ways to redirect the calls a module makes to another one: ImportReplaceOriginalByPatch
+// writes the patch function in the import slot, while FunctionReplaceOriginalByPatch leaves the slot pointing to the
+// original function, whose first instruction is replaced by a jump to the patch.
+// The jump is written in memory allocated with mmap, so this is only built for x86 POSIX systems.
+#include "DetoursTest.h"
+
+#include <cstring>
+#include <sys/mman.h>
+
+#if defined(__GNUC__)
+#define DETOURS_NOINLINE __attribute__((noinline))
+#else
+#define DETOURS_NOINLINE
+#endif
+
+static DETOURS_NOINLINE int PatchFunction(int value) { return value * 3 + 1; }
+
+using ImportedFunction = int (*)(int);
+
+// Import slots are read on every call, as the loader may write them.
+static ImportedFunction volatile importSlot;
+
+static double CallThroughImportSlot(size_t nbCalls)
+{
+    int result = 0;
+    const double ns = DetoursBenchNanoseconds(nbCalls, [&](size_t index) { result += importSlot(int(index)); });
+    DetoursDoNotOptimize(result);
+    return ns;
+}
+
+int main()
+{
+    // The detoured original function, reduced to the jump written by Detours.
+    uint8_t* const original = (uint8_t*)mmap(nullptr, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    DETOURS_CHECK(original != MAP_FAILED);
+#if defined(__x86_64__)
+    // jmp [rip+0], as the patch may be further than 2GiB away
+    const uint8_t jump[] = {0xFF, 0x25, 0, 0, 0, 0};
+    memcpy(original, jump, sizeof(jump));
+    const uint64_t patchAddress = uint64_t(uintptr_t(&PatchFunction));
+    memcpy(original + sizeof(jump), &patchAddress, sizeof(patchAddress));
+#else
+    // jmp rel32, as Detours writes on x86
+    original[0]            = 0xE9;
+    const int32_t relative = int32_t(uintptr_t(&PatchFunction) - uintptr_t(original + 5));
+    memcpy(original + 1, &relative, sizeof(relative));
+#endif
+
+    const size_t nbCalls = 100000000;
+    importSlot           = (ImportedFunction)(void*)original;
+    DETOURS_CHECK(importSlot(2) == PatchFunction(2));
+    const double detouredNs = CallThroughImportSlot(nbCalls);
+    importSlot              = &PatchFunction;
+    const double importNs   = CallThroughImportSlot(nbCalls);
+
+    std::printf("Call to a patched function from another module:\n");
+    std::printf("  FunctionReplaceOriginalByPatch (jump): %6.2f ns\n", detouredNs);
+    std::printf("  ImportReplaceOriginalByPatch:          %6.2f ns\n", importNs);
+    munmap(original, 4096);
+    return 0;
+}
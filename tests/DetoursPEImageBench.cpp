@@ -0,0 +1,40 @@
+// Cost of the DetoursPEImage lookups done for each patch dll: parsing the headers, finding the NameOfModulesToPatch
+// resource and resolving ordinals, on a file view (sections table lookups) and on a loaded image.
+#include "DetoursPEImage.h"
+#include "DetoursTest.h"
+#include "DetoursTestPE.h"
+
+int main()
+{
+    const DetoursTestPE pe      = DetoursBuildTestPE("D2Common.dll;D2Game.dll");
+    const size_t        nbCalls = 1000000;
+
+    std::printf("DetoursPEImage on a %zu bytes dll:\n", pe.file.size());
+    for (const DetoursPEImage::Layout layout : {DetoursPEImage::Layout::File, DetoursPEImage::Layout::Image})
+    {
+        const std::vector<uint8_t>& view = layout == DetoursPEImage::Layout::File ? pe.file : pe.image;
+
+        const double headersNs = DetoursBenchNanoseconds(nbCalls, [&](size_t) {
+            const DetoursPEImage image(view.data(), view.size(), layout);
+            DetoursDoNotOptimize(image.GetTimeDateStamp());
+        });
+        const DetoursPEImage image(view.data(), view.size(), layout);
+        const double resourceNs = DetoursBenchNanoseconds(nbCalls, [&](size_t) {
+            const uint8_t* data = nullptr;
+            uint32_t       size = 0;
+            DETOURS_CHECK(image.FindResource(256, "NameOfModulesToPatch", data, size));
+            DetoursDoNotOptimize(size);
+        });
+        DetoursPEImage::ExportDirectory exports;
+        DETOURS_CHECK(image.GetExportDirectory(exports));
+        const double exportNs = DetoursBenchNanoseconds(nbCalls, [&](size_t index) {
+            DetoursDoNotOptimize(image.GetExportRva(exports, uint32_t(DetoursTestPE::ordinalBase + index % 4)));
+        });
+
+        std::printf("  %s layout:\n", layout == DetoursPEImage::Layout::File ? "File" : "Image");
+        std::printf("    headers:      %8.1f ns\n", headersNs);
+        std::printf("    FindResource: %8.1f ns\n", resourceNs);
+        std::printf("    GetExportRva: %8.1f ns\n", exportNs);
+    }
+    return 0;
+}
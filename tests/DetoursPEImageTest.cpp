@@ -0,0 +1,176 @@
+// DetoursPEImage on a generated dll, in both layouts, then on randomly corrupted copies of it: every pointer returned
+// must stay within the view. Build with -fsanitize=address to also catch reads out of it.
+#include "DetoursPEImage.h"
+#include "DetoursTest.h"
+#include "DetoursTestPE.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char modulesToPatch[] = "D2Common.dll;D2Game.dll";
+
+static bool InView(const std::vector<uint8_t>& view, const uint8_t* data, size_t size)
+{
+    return data >= view.data() && data <= view.data() + view.size() && size_t(view.data() + view.size() - data) >= size;
+}
+
+static void CheckValidImage(const DetoursTestPE& pe, const std::vector<uint8_t>& view, DetoursPEImage::Layout layout)
+{
+    const DetoursPEImage image(view.data(), view.size(), layout);
+    DETOURS_CHECK(image.IsValid());
+    DETOURS_CHECK(image.GetTimeDateStamp() == 0x3E9A8C1F);
+    DETOURS_CHECK(image.GetCheckSum() == 0x1234ABCD);
+    DETOURS_CHECK(image.GetSizeOfImage() == DetoursTestPE::sizeOfImage);
+
+    DETOURS_CHECK(image.GetSectionsCount() == 3);
+    DetoursPEImage::Section section;
+    DETOURS_CHECK(image.GetSection(0, section));
+    DETOURS_CHECK(memcmp(section.name, ".text", 6) == 0);
+    DETOURS_CHECK(section.virtualAddress == DetoursTestPE::textRva);
+    DETOURS_CHECK(section.characteristics & DetoursPEImage::sectionExecutable);
+    DETOURS_CHECK(image.GetSection(2, section) && section.virtualAddress == DetoursTestPE::resourceRva);
+    DETOURS_CHECK(!image.GetSection(3, section));
+
+    // RVAs are resolved the same way in both layouts
+    const uint8_t* code = image.RvaToPointer(DetoursTestPE::uniqueFunctionRva, 3);
+    DETOURS_CHECK(code && InView(view, code, 3));
+    DETOURS_CHECK(code[0] == 0x33 && code[1] == 0xC0 && code[2] == 0xC3);
+    DETOURS_CHECK(image.RvaToPointer(0, 2) == view.data());
+    DETOURS_CHECK(!image.RvaToPointer(DetoursTestPE::sizeOfImage, 1));
+    DETOURS_CHECK(!image.RvaToPointer(0xFFFFFFFF, 2));
+    DETOURS_CHECK(!image.RvaToPointer(DetoursTestPE::textRva, size_t(1) << 30));
+    if (layout == DetoursPEImage::Layout::File)
+    {
+        // Only the raw data of the sections is in the file
+        DETOURS_CHECK(image.RvaToPointer(DetoursTestPE::textRva, 0x200));
+        DETOURS_CHECK(!image.RvaToPointer(DetoursTestPE::textRva, 0x201));
+        DETOURS_CHECK(!image.RvaToPointer(DetoursTestPE::textRva + 0x800, 1));
+    }
+
+    DetoursPEImage::ExportDirectory exports;
+    DETOURS_CHECK(image.GetExportDirectory(exports));
+    DETOURS_CHECK(exports.ordinalBase == DetoursTestPE::ordinalBase);
+    DETOURS_CHECK(exports.nbFunctions == DetoursTestPE::nbExportedOrdinals);
+    const uint32_t base = DetoursTestPE::ordinalBase;
+    DETOURS_CHECK(image.GetExportRva(exports, base - 1) == 0);
+    DETOURS_CHECK(image.GetExportRva(exports, base) == DetoursTestPE::sharedFunctionRva);
+    DETOURS_CHECK(image.GetExportRva(exports, base + 1) == DetoursTestPE::uniqueFunctionRva);
+    // Aliased ordinals share their RVA
+    DETOURS_CHECK(image.GetExportRva(exports, base + 2) == image.GetExportRva(exports, base));
+    const uint32_t forwardedRva = image.GetExportRva(exports, base + 3);
+    DETOURS_CHECK(DetoursPEImage::IsForwardedExport(exports, forwardedRva));
+    DETOURS_CHECK(!DetoursPEImage::IsForwardedExport(exports, DetoursTestPE::uniqueFunctionRva));
+    const uint8_t* forwarder = image.RvaToPointer(forwardedRva, 15);
+    DETOURS_CHECK(forwarder && memcmp(forwarder, "D2Common.10001", 15) == 0);
+    DETOURS_CHECK(image.GetExportRva(exports, base + 4) == 0);
+    DETOURS_CHECK(image.GetExportRva(exports, base + 5) == 0);
+    DETOURS_CHECK(image.GetExportRva(exports, 0) == 0);
+
+    const uint8_t* resourceData = nullptr;
+    uint32_t       resourceSize = 0;
+    // Names are case insensitive
+    DETOURS_CHECK(image.FindResource(256, "NameOfModulesToPatch", resourceData, resourceSize));
+    DETOURS_CHECK(InView(view, resourceData, resourceSize));
+    DETOURS_CHECK(resourceSize == sizeof(modulesToPatch) * 2);
+    for (size_t i = 0; i < sizeof(modulesToPatch); i++)
+        DETOURS_CHECK(resourceData[i * 2] == uint8_t(modulesToPatch[i]) && resourceData[i * 2 + 1] == 0);
+    DETOURS_CHECK(!image.FindResource(257, "NameOfModulesToPatch", resourceData, resourceSize));
+    DETOURS_CHECK(!image.FindResource(256, "NameOfModulesToPatc", resourceData, resourceSize));
+    DETOURS_CHECK(!image.FindResource(256, "NameOfModulesToPatchX", resourceData, resourceSize));
+    (void)pe;
+}
+
+static void CheckInvalidHeaders(const std::vector<uint8_t>& file)
+{
+    DETOURS_CHECK(!DetoursPEImage(nullptr, file.size(), DetoursPEImage::Layout::File).IsValid());
+    DETOURS_CHECK(!DetoursPEImage(file.data(), 0x40, DetoursPEImage::Layout::File).IsValid());
+    // Truncated in the section headers
+    DETOURS_CHECK(!DetoursPEImage(file.data(), 0x80 + 24 + 0xE0 + 40, DetoursPEImage::Layout::File).IsValid());
+
+    const auto checkCorrupted = [&](size_t offset, uint8_t value) {
+        std::vector<uint8_t> corrupted = file;
+        corrupted[offset]              = value;
+        const DetoursPEImage image(corrupted.data(), corrupted.size(), DetoursPEImage::Layout::File);
+        DETOURS_CHECK(!image.IsValid());
+        // Nothing can be read from an invalid image
+        const uint8_t* data = nullptr;
+        uint32_t       size = 0;
+        DetoursPEImage::ExportDirectory exports;
+        DETOURS_CHECK(!image.RvaToPointer(0, 1) && !image.GetExportDirectory(exports));
+        DETOURS_CHECK(!image.FindResource(256, "NameOfModulesToPatch", data, size));
+        DETOURS_CHECK(image.GetTimeDateStamp() == 0 && image.GetSizeOfImage() == 0);
+    };
+    checkCorrupted(0, 'X');              // MZ
+    checkCorrupted(0x3C, 0xF0);          // e_lfanew past the headers
+    checkCorrupted(0x3F, 0x80);          // e_lfanew past the file
+    checkCorrupted(0x80, 'X');           // PE signature
+    checkCorrupted(0x80 + 24, 0x0C);     // PE32+ magic
+    checkCorrupted(0x80 + 4 + 3, 0xFF);  // Too many sections
+}
+
+// Random byte changes in the headers and tables, which is where all the offsets and sizes are.
+static void Fuzz(const DetoursTestPE& pe, DetoursPEImage::Layout layout, size_t nbIterations)
+{
+    const std::vector<uint8_t>& reference = layout == DetoursPEImage::Layout::File ? pe.file : pe.image;
+    const uint32_t interestingValues[] = {0, 1, 0x7F, 0x80, 0xFF, 0xFFFF, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+    DetoursTestRandom random(uint64_t(layout) + 1);
+    size_t nbValid = 0, nbResourcesFound = 0;
+    for (size_t iteration = 0; iteration < nbIterations; iteration++)
+    {
+        // Also vary the size of the view, so that the tables can be truncated.
+        std::vector<uint8_t> view(reference.begin(), reference.begin() + (random.Below(8) == 0
+                                                                              ? random.Below(uint32_t(reference.size()))
+                                                                              : reference.size()));
+        const uint32_t nbMutations = 1 + random.Below(4);
+        for (uint32_t mutation = 0; mutation < nbMutations && !view.empty(); mutation++)
+        {
+            const uint32_t offset = random.Below(uint32_t(view.size()));
+            if (random.Below(2) == 0 && offset + 4 <= view.size())
+            {
+                const uint32_t value = interestingValues[random.Below(sizeof(interestingValues) / sizeof(uint32_t))];
+                memcpy(&view[offset], &value, sizeof(value));
+            }
+            else
+                view[offset] = uint8_t(random.Next());
+        }
+
+        const DetoursPEImage image(view.data(), view.size(), layout);
+        if (!image.IsValid()) continue;
+        nbValid++;
+        DetoursPEImage::Section section;
+        for (uint16_t sectionIndex = 0; sectionIndex < image.GetSectionsCount(); sectionIndex++)
+        {
+            DETOURS_CHECK(image.GetSection(sectionIndex, section));
+            const uint8_t* sectionData = image.RvaToPointer(section.virtualAddress, section.rawDataSize);
+            DETOURS_CHECK(!sectionData || InView(view, sectionData, section.rawDataSize));
+        }
+        DetoursPEImage::ExportDirectory exports;
+        if (image.GetExportDirectory(exports))
+        {
+            for (uint32_t ordinal = DetoursTestPE::ordinalBase - 1; ordinal < DetoursTestPE::ordinalBase + 6; ordinal++)
+                DetoursDoNotOptimize(image.GetExportRva(exports, ordinal));
+        }
+        const uint8_t* resourceData = nullptr;
+        uint32_t       resourceSize = 0;
+        if (image.FindResource(256, "NameOfModulesToPatch", resourceData, resourceSize))
+        {
+            DETOURS_CHECK(InView(view, resourceData, resourceSize));
+            nbResourcesFound++;
+        }
+    }
+    // Make sure the mutations do not make every image invalid, which would not test much.
+    DETOURS_CHECK(nbValid > nbIterations / 4 && nbResourcesFound > nbIterations / 8);
+}
+
+int main()
+{
+    const DetoursTestPE pe = DetoursBuildTestPE(modulesToPatch);
+    CheckValidImage(pe, pe.file, DetoursPEImage::Layout::File);
+    CheckValidImage(pe, pe.image, DetoursPEImage::Layout::Image);
+    CheckInvalidHeaders(pe.file);
+    Fuzz(pe, DetoursPEImage::Layout::File, 200000);
+    Fuzz(pe, DetoursPEImage::Layout::Image, 200000);
+    std::printf("DetoursPEImageTest passed\n");
+    return 0;
+}
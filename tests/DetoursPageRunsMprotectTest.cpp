@@ -0,0 +1,98 @@
+// Flushes pointer writes to read-only pages with mprotect standing in for VirtualProtect, as DetoursPatch does: every
+// run is made writable first, and nothing is written if one of them can not be. Protections are checked in
+// /proc/self/maps, so this is Linux only.
+#include "DetoursPageRuns.h"
+#include "DetoursTest.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+// Returns the "rwxp" permissions of the mapping containing address.
+static std::string PagePermissions(const void* address)
+{
+    std::ifstream maps("/proc/self/maps");
+    std::string   line;
+    while (std::getline(maps, line))
+    {
+        std::istringstream lineStream(line);
+        uintptr_t          begin = 0, end = 0;
+        char               dash;
+        std::string        permissions;
+        lineStream >> std::hex >> begin >> dash >> end >> permissions;
+        if (uintptr_t(address) >= begin && uintptr_t(address) < end) return permissions;
+    }
+    return "";
+}
+
+// Same steps as the commit of a patch transaction.
+static bool Flush(std::vector<DetoursPointerWrite>& writes, uintptr_t pageSize)
+{
+    std::vector<std::pair<uintptr_t, uintptr_t>> unprotectedRuns;
+    const auto restoreProtections = [&] {
+        for (const auto& run : unprotectedRuns)
+            DETOURS_CHECK(mprotect((void*)run.first, run.second - run.first, PROT_READ) == 0);
+    };
+    const bool writable = DetoursMakePointerWritesWritable(writes, pageSize, [&](uintptr_t runBegin, uintptr_t runEnd) {
+        if (mprotect((void*)runBegin, runEnd - runBegin, PROT_READ | PROT_WRITE) != 0) return false;
+        unprotectedRuns.push_back({runBegin, runEnd});
+        return true;
+    });
+    if (writable) DetoursApplyPointerWrites(writes);
+    restoreProtections();
+    writes.clear();
+    return writable;
+}
+
+int main()
+{
+    const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+    const size_t    nbPages  = 8;
+    uint8_t* const  pages    = (uint8_t*)mmap(nullptr, nbPages * pageSize, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    DETOURS_CHECK(pages != MAP_FAILED);
+    void** const table = (void**)pages;
+    const size_t nbPointersPerPage = pageSize / sizeof(void*);
+    for (size_t pointerIndex = 0; pointerIndex < nbPages * nbPointersPerPage; pointerIndex++)
+        table[pointerIndex] = (void*)pointerIndex;
+    // Read-only, as the import tables and .rdata of a module
+    DETOURS_CHECK(mprotect(pages, nbPages * pageSize, PROT_READ) == 0);
+    DETOURS_CHECK(PagePermissions(pages)[1] == '-');
+
+    // Writes to pages 0, 1 and 3, one of them copying a pointer written by an earlier one.
+    void* const sourceValue = (void*)0x1234;
+    std::vector<DetoursPointerWrite> writes = {
+        {&table[3 * nbPointersPerPage + 5], (void*)0xABC},
+        {&table[0], sourceValue},
+        {&table[nbPointersPerPage + 1], nullptr, &table[0]},
+        {&table[nbPointersPerPage - 1], nullptr, &table[7]},
+    };
+    DETOURS_CHECK(Flush(writes, pageSize));
+    DETOURS_CHECK(table[3 * nbPointersPerPage + 5] == (void*)0xABC);
+    DETOURS_CHECK(table[0] == sourceValue);
+    DETOURS_CHECK(table[nbPointersPerPage + 1] == sourceValue);
+    DETOURS_CHECK(table[nbPointersPerPage - 1] == (void*)7);
+    // Other pointers are untouched and every page is read-only again
+    DETOURS_CHECK(table[1] == (void*)1 && table[2 * nbPointersPerPage] == (void*)(2 * nbPointersPerPage));
+    for (size_t pageIndex = 0; pageIndex < nbPages; pageIndex++)
+        DETOURS_CHECK(PagePermissions(pages + pageIndex * pageSize)[1] == '-');
+
+    // A run containing an unmapped page can not be made writable: nothing is written, not even to the other runs.
+    DETOURS_CHECK(munmap(pages + 6 * pageSize, pageSize) == 0);
+    writes = {
+        {&table[1], (void*)0xDEAD},
+        {&table[6 * nbPointersPerPage], (void*)0xDEAD},
+        {&table[7 * nbPointersPerPage], (void*)0xDEAD},
+    };
+    DETOURS_CHECK(!Flush(writes, pageSize));
+    DETOURS_CHECK(table[1] == (void*)1 && table[7 * nbPointersPerPage] == (void*)(7 * nbPointersPerPage));
+    DETOURS_CHECK(PagePermissions(pages)[1] == '-' && PagePermissions(pages + 7 * pageSize)[1] == '-');
+
+    munmap(pages, 6 * pageSize);
+    munmap(pages + 7 * pageSize, pageSize);
+    std::printf("DetoursPageRunsMprotectTest passed\n");
+    return 0;
+}
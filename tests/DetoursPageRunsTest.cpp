@@ -0,0 +1,103 @@
+// Grouping of the pointer writes by runs of pages, and resolution of the values read from sources.
+#include "DetoursPageRuns.h"
+#include "DetoursTest.h"
+
+#include <vector>
+
+static const uintptr_t pageSize = 0x1000;
+
+static void** At(uintptr_t address) { return (void**)address; }
+
+struct PageRun
+{
+    uintptr_t begin;
+    uintptr_t end;
+    size_t    nbWrites;
+};
+
+static std::vector<PageRun> PageRuns(std::vector<DetoursPointerWrite>& writes)
+{
+    std::vector<PageRun> runs;
+    DetoursForEachPageRun(writes, pageSize,
+                          [&](uintptr_t runBegin, uintptr_t runEnd, const DetoursPointerWrite* firstWrite,
+                              const DetoursPointerWrite* lastWrite) {
+                              runs.push_back({runBegin, runEnd, size_t(lastWrite - firstWrite)});
+                          });
+    return runs;
+}
+
+static void CheckPageRuns()
+{
+    std::vector<DetoursPointerWrite> writes;
+    DETOURS_CHECK(PageRuns(writes).empty());
+
+    // Contiguous pages are merged, in any queue order, and a gap starts a new run.
+    writes = {{At(0x10FF0), (void*)1}, {At(0x10000), (void*)2}, {At(0x11008), (void*)3}, {At(0x13000), (void*)4}};
+    std::vector<PageRun> runs = PageRuns(writes);
+    DETOURS_CHECK(runs.size() == 2);
+    DETOURS_CHECK(runs[0].begin == 0x10000 && runs[0].end == 0x12000 && runs[0].nbWrites == 3);
+    DETOURS_CHECK(runs[1].begin == 0x13000 && runs[1].end == 0x14000 && runs[1].nbWrites == 1);
+    for (size_t writeIndex = 1; writeIndex < writes.size(); writeIndex++)
+        DETOURS_CHECK(writes[writeIndex - 1].address < writes[writeIndex].address);
+
+    // A pointer straddling two pages needs both.
+    writes = {{At(0x20FFE), nullptr}};
+    runs   = PageRuns(writes);
+    DETOURS_CHECK(runs.size() == 1 && runs[0].begin == 0x20000 && runs[0].end == 0x22000);
+    // And joins a write to the next page in the same run.
+    writes = {{At(0x20FFE), nullptr}, {At(0x21800), nullptr}, {At(0x23000), nullptr}};
+    runs   = PageRuns(writes);
+    DETOURS_CHECK(runs.size() == 2 && runs[0].end == 0x22000 && runs[0].nbWrites == 2);
+
+    // Writes to the same address keep their queue order, so that the last one wins.
+    writes = {{At(0x30010), (void*)1}, {At(0x30000), (void*)2}, {At(0x30010), (void*)3}, {At(0x30010), (void*)4}};
+    PageRuns(writes);
+    DETOURS_CHECK(writes[1].value == (void*)1 && writes[2].value == (void*)3 && writes[3].value == (void*)4);
+}
+
+static void CheckResolve()
+{
+    void* table[4] = {(void*)0xA0, (void*)0xA1, (void*)0xA2, (void*)0xA3};
+    void* slots[3] = {};
+    // slots[0] = table[0]; table[1] = slots[0]; slots[1] = table[1]; table[0] = 0xB0; slots[2] = table[0]
+    std::vector<DetoursPointerWrite> writes = {
+        {&slots[0], nullptr, &table[0]}, {&table[1], nullptr, &slots[0]}, {&slots[1], nullptr, &table[1]},
+        {&table[0], (void*)0xB0},        {&slots[2], nullptr, &table[0]},
+    };
+    // Sources are only read when resolving, not when queuing.
+    table[0] = (void*)0xC0;
+    DetoursResolvePointerWrites(writes);
+    for (const DetoursPointerWrite& write : writes)
+        DETOURS_CHECK(write.source == nullptr);
+    DETOURS_CHECK(writes[0].value == (void*)0xC0);
+    DETOURS_CHECK(writes[1].value == (void*)0xC0);
+    DETOURS_CHECK(writes[2].value == (void*)0xC0);
+    DETOURS_CHECK(writes[4].value == (void*)0xB0);
+    // Nothing was written yet
+    DETOURS_CHECK(table[1] == (void*)0xA1 && slots[0] == nullptr);
+
+    DetoursApplyPointerWrites(writes);
+    DETOURS_CHECK(slots[0] == (void*)0xC0 && slots[1] == (void*)0xC0 && slots[2] == (void*)0xB0);
+    DETOURS_CHECK(table[0] == (void*)0xB0 && table[1] == (void*)0xC0);
+}
+
+static void CheckMakeWritableStopsAtFailure()
+{
+    std::vector<DetoursPointerWrite> writes = {{At(0x50000), nullptr}, {At(0x40000), nullptr}, {At(0x60000), nullptr}};
+    std::vector<uintptr_t>           unprotectedRuns;
+    const bool writable = DetoursMakePointerWritesWritable(writes, pageSize, [&](uintptr_t runBegin, uintptr_t) {
+        unprotectedRuns.push_back(runBegin);
+        return runBegin != 0x50000;
+    });
+    DETOURS_CHECK(!writable);
+    DETOURS_CHECK(unprotectedRuns.size() == 2 && unprotectedRuns[0] == 0x40000 && unprotectedRuns[1] == 0x50000);
+}
+
+int main()
+{
+    CheckPageRuns();
+    CheckResolve();
+    CheckMakeWritableStopsAtFailure();
+    std::printf("DetoursPageRunsTest passed\n");
+    return 0;
+}
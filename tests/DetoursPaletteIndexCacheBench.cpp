@@ -0,0 +1,83 @@
+// Cost of a DetoursPaletteIndexCache hit in a full palette, against the uncached nearest color search it memoizes.
+// Hashing the palette is given as a reference, as it is only done by misses.
+#include "DetoursPaletteIndexCache.h"
+#include "DetoursTest.h"
+
+#include <vector>
+
+static const int paletteSize = 256;
+
+// Same search as D2GetNearestPaletteIndex, with 4 bytes per entry and ties resolved to the lowest index.
+static uint8_t ReferenceNearest(const uint8_t* palette, int red, int green, int blue)
+{
+    int bestDistance = 1 << 30;
+    int bestIndex    = 0;
+    for (int i = 0; i < paletteSize; i++)
+    {
+        const int dr = palette[i * 4 + 2] - red, dg = palette[i * 4 + 1] - green, db = palette[i * 4] - blue;
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            bestIndex    = i;
+        }
+    }
+    return uint8_t(bestIndex);
+}
+
+int main()
+{
+    DetoursTestRandom    random(18);
+    std::vector<uint8_t> palette(paletteSize * 4);
+    for (uint8_t& component : palette)
+        component = uint8_t(random.Next());
+    std::vector<uint32_t> colors(2048);
+    for (uint32_t& color : colors)
+        color = uint32_t(random.Next()) & 0xFFFFFF;
+
+    DetoursPaletteIndexCache cache;
+    size_t                   nbComputed = 0;
+    const auto               get        = [&](uint32_t color) {
+        const int red = int(color >> 16), green = int((color >> 8) & 0xFF), blue = int(color & 0xFF);
+        return cache.Get(palette.data(), paletteSize, palette.size(), red, green, blue, [&] {
+            nbComputed++;
+            return ReferenceNearest(palette.data(), red, green, blue);
+        });
+    };
+    for (int round = 0; round < 2; round++)
+    {
+        for (const uint32_t color : colors)
+            get(color);
+    }
+    // The table is direct mapped, colors evicting each other are left out so that only hits are measured.
+    std::vector<uint32_t> hitColors;
+    for (const uint32_t color : colors)
+    {
+        const size_t nbComputedBefore = nbComputed;
+        get(color);
+        if (nbComputed == nbComputedBefore) hitColors.push_back(color);
+    }
+    nbComputed = 0;
+
+    const size_t nbCalls = 20000000;
+    uint32_t     result  = 0;
+    const double hitNs   = DetoursBenchNanoseconds(nbCalls, [&](size_t index) {
+        result += get(hitColors[index % hitColors.size()]);
+    });
+    DETOURS_CHECK(nbComputed == 0);
+    const double searchNs = DetoursBenchNanoseconds(nbCalls / 20, [&](size_t index) {
+        const uint32_t color = colors[index % colors.size()];
+        result += ReferenceNearest(palette.data(), int(color >> 16), int((color >> 8) & 0xFF), int(color & 0xFF));
+    });
+    const double hashNs = DetoursBenchNanoseconds(nbCalls / 20, [&](size_t index) {
+        palette[0] = uint8_t(index);
+        result += uint32_t(DetoursHash64(palette.data(), palette.size()));
+    });
+    DetoursDoNotOptimize(result);
+
+    std::printf("Nearest index in a %d entries palette:\n", paletteSize);
+    std::printf("  cache hit:       %7.1f ns\n", hitNs);
+    std::printf("  uncached search: %7.1f ns\n", searchNs);
+    std::printf("  palette hash:    %7.1f ns, only done by misses\n", hashNs);
+    return 0;
+}
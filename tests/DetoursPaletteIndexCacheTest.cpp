@@ -0,0 +1,192 @@
+// DetoursPaletteIndexCache must return exactly what the function it memoizes returns: checked against a reference
+// nearest color search with more palettes than slots, palettes modified in place, and several threads at once.
+// Palettes have 4 bytes per entry, blue first, as the palettes given to D2GetNearestPaletteIndex.
+#include "DetoursPaletteIndexCache.h"
+#include "DetoursTest.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const int paletteSize = 256;
+
+// Stands for D2GetNearestPaletteIndex, with 4 bytes per entry and ties resolved to the lowest index.
+static uint8_t ReferenceNearest(const uint8_t* palette, int red, int green, int blue)
+{
+    int bestDistance = 1 << 30;
+    int bestIndex    = 0;
+    for (int i = 0; i < paletteSize; i++)
+    {
+        const int dr = palette[i * 4 + 2] - red, dg = palette[i * 4 + 1] - green, db = palette[i * 4] - blue;
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            bestIndex    = i;
+        }
+    }
+    return uint8_t(bestIndex);
+}
+
+// Few levels per component so that ties are common.
+static std::vector<uint8_t> RandomPalette(DetoursTestRandom& random)
+{
+    std::vector<uint8_t> palette(paletteSize * 4);
+    for (uint8_t& component : palette)
+        component = uint8_t(random.Below(6) * 51);
+    return palette;
+}
+
+struct Color
+{
+    int red, green, blue;
+};
+
+static void SetEntry(std::vector<uint8_t>& palette, int index, const Color& color)
+{
+    palette[index * 4 + 2] = uint8_t(color.red);
+    palette[index * 4 + 1] = uint8_t(color.green);
+    palette[index * 4]     = uint8_t(color.blue);
+}
+
+// Colors are picked among a small set, so that lookups hit once the palette has a table.
+static Color RandomColor(DetoursTestRandom& random)
+{
+    const uint32_t color = random.Below(4096) * 4099;
+    return {int(color & 0xFF), int((color >> 8) & 0xFF), int((color >> 16) & 0xFF)};
+}
+
+static uint8_t Get(DetoursPaletteIndexCache& cache, const std::vector<uint8_t>& palette, const Color& color,
+                   size_t& nbComputed)
+{
+    return cache.Get(palette.data(), paletteSize, palette.size(), color.red, color.green, color.blue, [&] {
+        nbComputed++;
+        return ReferenceNearest(palette.data(), color.red, color.green, color.blue);
+    });
+}
+
+static void CheckSingleThread()
+{
+    DetoursTestRandom                 random(15);
+    DetoursPaletteIndexCache          cache;
+    std::vector<std::vector<uint8_t>> palettes;
+    for (unsigned paletteIndex = 0; paletteIndex < DetoursPaletteIndexCache::maxPalettes + 2; paletteIndex++)
+        palettes.push_back(RandomPalette(random));
+
+    // Two palettes used most of the time, the others often enough to evict slots.
+    size_t nbComputed = 0;
+    for (size_t call = 0; call < 2000000; call++)
+    {
+        const uint32_t              pick    = random.Below(16);
+        const std::vector<uint8_t>& palette = palettes[pick < 14 ? pick % 2 : 2 + random.Below(4)];
+        const Color                 color   = RandomColor(random);
+        DETOURS_CHECK(Get(cache, palette, color, nbComputed) ==
+                      ReferenceNearest(palette.data(), color.red, color.green, color.blue));
+    }
+    // Most calls must have been hits.
+    DETOURS_CHECK(nbComputed < 400000);
+
+    // Once a color is in the table, modifying the palette in place must not return the old index. Entry 0 is part of
+    // the snapshot compared by every lookup, so this is seen at once.
+    std::vector<uint8_t>& palette = palettes[0];
+    const Color           color{200, 100, 50};
+    for (int call = 0; call < 100; call++)
+        Get(cache, palette, color, nbComputed);
+    nbComputed = 0;
+    const uint8_t index = Get(cache, palette, color, nbComputed);
+    DETOURS_CHECK(nbComputed == 0 && index != 0);
+    SetEntry(palette, 0, color);
+    DETOURS_CHECK(Get(cache, palette, color, nbComputed) == 0);
+
+    // Entry 1 is not, so its modification is only seen once a miss hashed the palette again.
+    for (int call = 0; call < 100; call++)
+        Get(cache, palette, color, nbComputed);
+    const Color otherColor{201, 100, 50};
+    SetEntry(palette, 1, otherColor);
+    Get(cache, palette, Color{17, 42, 99}, nbComputed);
+    nbComputed = 0;
+    DETOURS_CHECK(Get(cache, palette, otherColor, nbComputed) == 1 && nbComputed == 1);
+    DETOURS_CHECK(Get(cache, palette, color, nbComputed) == 0 && nbComputed == 2);
+}
+
+// Enough replacements for the generations stored in the entries to wrap around.
+static void CheckGenerationsWrap()
+{
+    DetoursTestRandom                 random(16);
+    DetoursPaletteIndexCache          cache;
+    std::vector<std::vector<uint8_t>> palettes;
+    for (unsigned paletteIndex = 0; paletteIndex < DetoursPaletteIndexCache::maxPalettes + 1; paletteIndex++)
+        palettes.push_back(RandomPalette(random));
+    size_t nbComputed = 0;
+    for (size_t round = 0; round < 12000; round++)
+    {
+        // Every slot gets a table, then every palette comes back in a slot used by another one.
+        for (const std::vector<uint8_t>& palette : palettes)
+        {
+            for (int call = 0; call < 4; call++)
+            {
+                const Color color = call < 2 ? Color{10, 20, 30} : RandomColor(random);
+                DETOURS_CHECK(Get(cache, palette, color, nbComputed) ==
+                              ReferenceNearest(palette.data(), color.red, color.green, color.blue));
+            }
+            if (round == 0)
+            {
+                for (int call = 0; call < int(DetoursPaletteIndexCache::promotionThreshold); call++)
+                    Get(cache, palette, RandomColor(random), nbComputed);
+            }
+        }
+    }
+}
+
+// Threads share the palettes, and compare every result with answers computed beforehand.
+static void CheckThreads()
+{
+    DetoursTestRandom                 random(17);
+    DetoursPaletteIndexCache          cache;
+    std::vector<std::vector<uint8_t>> palettes;
+    std::vector<std::vector<uint8_t>> answers;
+    for (unsigned paletteIndex = 0; paletteIndex < DetoursPaletteIndexCache::maxPalettes + 2; paletteIndex++)
+    {
+        palettes.push_back(RandomPalette(random));
+        std::vector<uint8_t> paletteAnswers(4096);
+        for (uint32_t colorIndex = 0; colorIndex < 4096; colorIndex++)
+        {
+            const uint32_t color       = colorIndex * 4099;
+            paletteAnswers[colorIndex] = ReferenceNearest(palettes.back().data(), int(color & 0xFF),
+                                                          int((color >> 8) & 0xFF), int((color >> 16) & 0xFF));
+        }
+        answers.push_back(paletteAnswers);
+    }
+
+    std::atomic<size_t>      nbMismatches{0};
+    std::vector<std::thread> threads;
+    for (unsigned threadIndex = 0; threadIndex < 4; threadIndex++)
+    {
+        threads.emplace_back([&, threadIndex] {
+            DetoursTestRandom threadRandom(100 + threadIndex);
+            size_t            nbComputed = 0;
+            for (size_t call = 0; call < 500000; call++)
+            {
+                const uint32_t pick         = threadRandom.Below(16);
+                const uint32_t paletteIndex = pick < 12 ? pick % 3 : 3 + threadRandom.Below(3);
+                const uint32_t colorIndex   = threadRandom.Below(4096);
+                const uint32_t color        = colorIndex * 4099;
+                const Color    rgb{int(color & 0xFF), int((color >> 8) & 0xFF), int((color >> 16) & 0xFF)};
+                if (Get(cache, palettes[paletteIndex], rgb, nbComputed) != answers[paletteIndex][colorIndex])
+                    nbMismatches++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    DETOURS_CHECK(nbMismatches == 0);
+}
+
+int main()
+{
+    CheckSingleThread();
+    CheckGenerationsWrap();
+    CheckThreads();
+    std::printf("DetoursPaletteIndexCacheTest passed\n");
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Time to find the modules targeted by the dlls of a patch folder: cold, by reading their NameOfModulesToPatch
+// resource, and warm, from D2.Detours.manifest. Loading the dlls as datafiles, as was done before the manifest, is
+// given as a reference. Windows only, since the manifest maps the files.
+#include "DetoursMappedFile.h"
+#include "DetoursPEImage.h"
+#include "DetoursPatchManifest.h"
+#include "DetoursTest.h"
+#include "DetoursTestPE.h"
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+struct PatchFile
+{
+    std::wstring     path;
+    WIN32_FIND_DATAW findData;
+};
+
+static bool ReadTargets(const PatchFile& patchFile, DetoursPatchManifest::Entry& entry)
+{
+    DetoursMappedFile    file(patchFile.path.c_str());
+    const DetoursPEImage image(file.data, file.size, DetoursPEImage::Layout::File);
+    const uint8_t*       resourceData = nullptr;
+    uint32_t             resourceSize = 0;
+    if (!image.FindResource(256, "NameOfModulesToPatch", resourceData, resourceSize)) return false;
+    std::wstring targets((const wchar_t*)resourceData, resourceSize / sizeof(wchar_t));
+    entry.isPatch = true;
+    entry.targetModules.assign(1, targets.c_str());
+    return true;
+}
+
+int main()
+{
+    wchar_t tempPath[MAX_PATH];
+    DETOURS_CHECK(GetTempPathW(MAX_PATH, tempPath) != 0);
+    const std::wstring folder = std::wstring(tempPath) + L"D2.Detours.ManifestBench";
+    CreateDirectoryW(folder.c_str(), nullptr);
+
+    // Patch dlls are a few hundred KiB, which matters as the manifest hashes them.
+    const size_t nbDlls = 64, paddingSize = 256 * 1024;
+    std::vector<PatchFile> patchFiles;
+    for (size_t dllIndex = 0; dllIndex < nbDlls; dllIndex++)
+    {
+        DetoursTestPE pe = DetoursBuildTestPE("D2Common.dll;D2Game.dll", uint32_t(0x3E9A8C1F + dllIndex));
+        pe.file.resize(pe.file.size() + paddingSize, uint8_t(dllIndex));
+        const std::wstring path  = folder + L"\\Patch" + std::to_wstring(dllIndex) + L".dll";
+        const HANDLE       hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                               FILE_ATTRIBUTE_NORMAL, nullptr);
+        DETOURS_CHECK(hFile != INVALID_HANDLE_VALUE);
+        DWORD written = 0;
+        DETOURS_CHECK(WriteFile(hFile, pe.file.data(), DWORD(pe.file.size()), &written, nullptr));
+        CloseHandle(hFile);
+
+        PatchFile patchFile{path, {}};
+        const HANDLE searchHandle = FindFirstFileW(path.c_str(), &patchFile.findData);
+        DETOURS_CHECK(searchHandle != INVALID_HANDLE_VALUE);
+        FindClose(searchHandle);
+        patchFiles.push_back(patchFile);
+    }
+    const std::wstring manifestPath = folder + L"\\D2.Detours.manifest";
+    DeleteFileW(manifestPath.c_str());
+
+    const double datafileNs = DetoursBenchNanoseconds(nbDlls, [&](size_t dllIndex) {
+        const HMODULE hModule = LoadLibraryExW(patchFiles[dllIndex].path.c_str(), nullptr, LOAD_LIBRARY_AS_DATAFILE);
+        DETOURS_CHECK(hModule);
+        DETOURS_CHECK(FindResourceW(hModule, L"NameOfModulesToPatch", MAKEINTRESOURCEW(256)));
+        FreeLibrary(hModule);
+    });
+
+    DetoursPatchManifest coldManifest{manifestPath};
+    DETOURS_CHECK(!coldManifest.Load());
+    const double coldNs = DetoursBenchNanoseconds(nbDlls, [&](size_t dllIndex) {
+        const PatchFile&            patchFile = patchFiles[dllIndex];
+        DetoursPatchManifest::Entry entry;
+        DETOURS_CHECK(DetoursPatchManifest::ComputeFileKey(patchFile.path.c_str(), patchFile.findData, entry.key));
+        DETOURS_CHECK(ReadTargets(patchFile, entry));
+        coldManifest.Store(patchFile.findData.cFileName, entry);
+    });
+    DETOURS_CHECK(coldManifest.SaveIfModified());
+
+    DetoursPatchManifest warmManifest{manifestPath};
+    DETOURS_CHECK(warmManifest.Load());
+    const double warmNs = DetoursBenchNanoseconds(nbDlls, [&](size_t dllIndex) {
+        const PatchFile&                patchFile = patchFiles[dllIndex];
+        DetoursPatchManifest::FileKey   key;
+        DETOURS_CHECK(DetoursPatchManifest::ComputeFileKey(patchFile.path.c_str(), patchFile.findData, key));
+        const DetoursPatchManifest::Entry* entry = warmManifest.Find(patchFile.findData.cFileName, key);
+        DETOURS_CHECK(entry && entry->targetModules.size() == 1 && entry->targetModules[0] == L"D2Common.dll;D2Game.dll");
+    });
+
+    std::printf("Reading the targets of %zu patch dlls of %zu KiB:\n", nbDlls, (paddingSize + 0xA00) / 1024);
+    std::printf("  LoadLibraryEx as datafile: %10.1f us/dll\n", datafileNs / 1000);
+    std::printf("  cold, parsing the dll:     %10.1f us/dll\n", coldNs / 1000);
+    std::printf("  warm, from the manifest:   %10.1f us/dll\n", warmNs / 1000);
+
+    for (const PatchFile& patchFile : patchFiles)
+        DeleteFileW(patchFile.path.c_str());
+    DeleteFileW(manifestPath.c_str());
+    RemoveDirectoryW(folder.c_str());
+    return 0;
+}
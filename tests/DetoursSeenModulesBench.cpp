@@ -0,0 +1,82 @@
+// Cost of DetoursApplyPatches looking for new modules after a LoadLibrary call, with a fake module enumerator standing
+// in for DetourEnumerateModules. The baseline is what it did before DetoursSeenModules: resolve the name of every
+// loaded module and compare it with every registered patch.
+#include "DetoursSeenModules.h"
+#include "DetoursTest.h"
+
+#include <cwctype>
+#include <string>
+#include <vector>
+
+struct FakeModule
+{
+    uint32_t     imageIdentity;
+    std::wstring fileName;
+};
+
+static std::vector<FakeModule> fakeModules;
+
+static const FakeModule* EnumerateFakeModules(const FakeModule* previous)
+{
+    if (fakeModules.empty()) return nullptr;
+    if (!previous) return &fakeModules.front();
+    return previous + 1 == &*fakeModules.end() ? nullptr : previous + 1;
+}
+
+static bool EqualsIgnoreCase(const std::wstring& lhs, const std::wstring& rhs)
+{
+    if (lhs.size() != rhs.size()) return false;
+    for (size_t i = 0; i < lhs.size(); i++)
+        if (towlower(lhs[i]) != towlower(rhs[i])) return false;
+    return true;
+}
+
+int main()
+{
+    // A D2 process has about a hundred modules loaded, and a few dozen patch dlls.
+    const size_t nbModules = 120, nbPatches = 40, nbCalls = 100000;
+    for (size_t moduleIndex = 0; moduleIndex < nbModules; moduleIndex++)
+        fakeModules.push_back({uint32_t(moduleIndex * 7919), L"C:\\Diablo II\\Module" + std::to_wstring(moduleIndex) + L".dll"});
+    std::vector<std::wstring> patchTargets;
+    for (size_t patchIndex = 0; patchIndex < nbPatches; patchIndex++)
+        patchTargets.push_back(L"PATCHED" + std::to_wstring(patchIndex) + L".DLL");
+
+    const auto getImageIdentity = [](const FakeModule* module) { return module->imageIdentity; };
+
+    // Every module is new the first time, then none is.
+    DetoursSeenModules seenModules;
+    size_t             nbNewModules = 0;
+    const auto         countNewModules = [&] {
+        nbNewModules = 0;
+        seenModules.ForEachNewModule<const FakeModule*>(EnumerateFakeModules, getImageIdentity,
+                                                        [&](const FakeModule*) { nbNewModules++; });
+        return nbNewModules;
+    };
+    DETOURS_CHECK(countNewModules() == nbModules);
+    DETOURS_CHECK(countNewModules() == 0);
+    // Another image loaded at the address of an unloaded module is new.
+    fakeModules[5].imageIdentity++;
+    DETOURS_CHECK(countNewModules() == 1);
+    DETOURS_CHECK(countNewModules() == 0);
+    seenModules.Clear();
+    DETOURS_CHECK(countNewModules() == nbModules);
+
+    const double scanAllNs = DetoursBenchNanoseconds(nbCalls / 100, [&](size_t) {
+        size_t nbMatches = 0;
+        for (const FakeModule* module = EnumerateFakeModules(nullptr); module; module = EnumerateFakeModules(module))
+        {
+            // GetModuleFileNameW copies the name
+            std::wstring fileName = module->fileName;
+            fileName.erase(0, fileName.find_last_of(L'\\') + 1);
+            for (const std::wstring& patchTarget : patchTargets)
+                nbMatches += EqualsIgnoreCase(fileName, patchTarget);
+        }
+        DetoursDoNotOptimize(nbMatches);
+    });
+    const double newModulesNs = DetoursBenchNanoseconds(nbCalls, [&](size_t) { DetoursDoNotOptimize(countNewModules()); });
+
+    std::printf("Looking for new modules among %zu modules, with %zu patches:\n", nbModules, nbPatches);
+    std::printf("  name compare of every module: %10.1f ns/call\n", scanAllNs);
+    std::printf("  DetoursSeenModules:           %10.1f ns/call\n", newModulesNs);
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Which calls DetoursShadowCall samples, in which order it runs the two functions, and which samples it compares.
+// Mismatches are logged by DetoursShadow.cpp, which depends on Windows, so the test records them instead, and checks
+// the lines it would log separately.
+#include "DetoursShadow.h"
+#include "DetoursTest.h"
+
+#include <climits>
+#include <string>
+
+static size_t               nbLoggedMismatches;
+static std::vector<uint8_t> loggedInputs;
+static std::vector<uint8_t> loggedMemory;
+
+void DetoursShadowSite::LogMismatch(uint64_t, const std::vector<uint8_t>& inputs, DetoursShadowMemory memory,
+                                    const void*, const void*, size_t) const
+{
+    nbLoggedMismatches++;
+    loggedInputs = inputs;
+    loggedMemory.assign((const uint8_t*)memory.data, (const uint8_t*)memory.data + memory.size);
+}
+
+static const DetoursShadowMemory noMemory{};
+
+static int Original(int value) { return value * 2; }
+
+static void CheckSampling()
+{
+    // Disabled: only the replacement runs.
+    DetoursShadowSite disabledSite(1, 0);
+    size_t            nbOriginalCalls = 0;
+    const auto        countedOriginal = [&](int value) { return nbOriginalCalls++, Original(value); };
+    const auto        replacement     = [](bool&, int value) { return Original(value); };
+    for (int call = 0; call < 10; call++)
+    {
+        DETOURS_CHECK(DetoursShadowCall(
+                          disabledSite, [] { return noMemory; }, countedOriginal, replacement, call) == call * 2);
+    }
+    DETOURS_CHECK(nbOriginalCalls == 0 && disabledSite.GetNbSamples() == 0);
+
+    // One call out of three.
+    DetoursShadowSite site(2, 3);
+    for (int call = 0; call < 30; call++)
+        DetoursShadowCall(site, [] { return noMemory; }, countedOriginal, replacement, call);
+    DETOURS_CHECK(nbOriginalCalls == 10 && site.GetNbSamples() == 10 && site.GetNbMismatches() == 0);
+}
+
+static void CheckOrderAlternates()
+{
+    DetoursShadowSite site(3, 1);
+    std::string       calls;
+    const auto        original    = [&](int value) { return calls += 'O', Original(value); };
+    const auto        replacement = [&](bool&, int value) { return calls += 'R', Original(value); };
+    for (int call = 0; call < 4; call++)
+        DetoursShadowCall(site, [] { return noMemory; }, original, replacement, call);
+    DETOURS_CHECK(calls == "ORROORRO");
+}
+
+static void CheckSkippedSamples()
+{
+    // A replacement forwarding to the original would be compared with itself: here the results differ on purpose, the
+    // original returning something new on every call.
+    DetoursShadowSite site(4, 1);
+    int               nbOriginalCalls = 0;
+    const auto        original        = [&](int) { return ++nbOriginalCalls; };
+    const auto        forwarding      = [&](bool& forwarded, int value) { return forwarded = true, original(value); };
+    for (int call = 0; call < 4; call++)
+        DetoursShadowCall(site, [] { return noMemory; }, original, forwarding, call);
+    DETOURS_CHECK(site.GetNbSkipped() == 4 && site.GetNbSamples() == 0 && site.GetNbMismatches() == 0);
+
+    // Both functions see the same memory, so a sample during which it changed can not be compared.
+    DetoursShadowSite site2(5, 1);
+    int               counter  = 0;
+    const auto        describe = [&] { return DetoursShadowMemory{&counter, sizeof(counter)}; };
+    const auto        writing  = [](int* value) { return ++*value; };
+    const auto        reading  = [](bool&, int* value) { return *value; };
+    DetoursShadowCall(site2, describe, writing, reading, &counter);
+    DETOURS_CHECK(site2.GetNbSkipped() == 1 && site2.GetNbMismatches() == 0);
+}
+
+static void CheckMismatches()
+{
+    DetoursShadowSite    site(6, 1);
+    std::vector<uint8_t> palette(16, 7);
+    const auto           describe    = [&] { return DetoursShadowMemory{palette.data(), palette.size()}; };
+    const auto           original    = [](const uint8_t* data, int index) { return data[index]; };
+    const auto           replacement = [](bool&, const uint8_t* data, int index) { return uint8_t(data[index] + 1); };
+    const size_t         nbCalls     = DetoursShadowSite::maxLoggedMismatches + 4;
+    for (size_t call = 0; call < nbCalls; call++)
+        DETOURS_CHECK(DetoursShadowCall(site, describe, original, replacement, palette.data(), 3) == 8);
+    DETOURS_CHECK(site.GetNbSamples() == nbCalls && site.GetNbMismatches() == nbCalls);
+    DETOURS_CHECK(nbLoggedMismatches == DetoursShadowSite::maxLoggedMismatches);
+
+    // Enough to replay the call: the inputs as passed, and the memory they point to.
+    const uint8_t* const data  = palette.data();
+    const int            index = 3;
+    std::vector<uint8_t> expectedInputs;
+    DetoursShadowAppendBytes(expectedInputs, data);
+    DetoursShadowAppendBytes(expectedInputs, index);
+    DETOURS_CHECK(loggedInputs == expectedInputs && loggedMemory == palette);
+}
+
+// Lines of a mismatch dumping a full palette, the largest memory the D2CMP sites describe, with the longest numbers.
+static void CheckMismatchLinesFitInRecords()
+{
+    std::vector<uint8_t> palette(256 * 4);
+    for (size_t i = 0; i < palette.size(); i++)
+        palette[i] = uint8_t(i * 7);
+    std::vector<uint8_t> inputs;
+    DetoursShadowAppendBytes(inputs, palette.data());
+    DetoursShadowAppendBytes(inputs, 255);
+    const uint32_t originalResult = 12, replacementResult = 13;
+    const std::vector<std::string> lines =
+        DetoursShadowMismatchLines(INT_MIN, UINT64_MAX, inputs, {palette.data(), palette.size()}, &originalResult,
+                                   &replacementResult, sizeof(uint32_t));
+
+    // Same prefix as DetoursShadow.cpp. format_to_n cuts what does not fit in the text of the record.
+    const std::string prefix = "(DetoursShadow):";
+    std::string       memoryHex;
+    size_t            nbMemoryLines = 0;
+    for (const std::string& line : lines)
+    {
+        DETOURS_CHECK(prefix.size() + line.size() <= sizeof(DetoursLogRecord::text) && line.back() == '\n');
+
+        const std::string memoryTag = "Shadow mismatch #18446744073709551615 of ordinal -2147483648: memory ";
+        if (line.compare(0, memoryTag.size(), memoryTag) != 0) continue;
+        const size_t equal = line.find('=');
+        DETOURS_CHECK(line.compare(memoryTag.size(), equal - memoryTag.size(),
+                                   std::to_string(nbMemoryLines + 1) + "/" +
+                                       std::to_string(palette.size() / detoursShadowBytesPerLine + 1)) == 0);
+        memoryHex.append(line, equal + 1, line.size() - equal - 2);
+        nbMemoryLines++;
+    }
+    DETOURS_CHECK(nbMemoryLines > 1);
+    // The parts put back together give the whole palette.
+    DETOURS_CHECK(memoryHex.size() == palette.size() * 2);
+    for (size_t i = 0; i < palette.size(); i++)
+        DETOURS_CHECK(std::stoul(memoryHex.substr(i * 2, 2), nullptr, 16) == palette[i]);
+    DETOURS_CHECK(lines.back() == "Shadow mismatch #18446744073709551615 of ordinal -2147483648: replacement 1/1="
+                                  "0D000000\n");
+}
+
+int main()
+{
+    CheckSampling();
+    CheckOrderAlternates();
+    CheckSkippedSamples();
+    CheckMismatches();
+    CheckMismatchLinesFitInRecords();
+    std::printf("DetoursShadowTest passed\n");
+    return 0;
+}
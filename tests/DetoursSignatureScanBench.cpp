@@ -0,0 +1,56 @@
+// Scan of a code section the size of D2Common's for patterns as found in patches, against a naive search.
+#include "DetoursSignatureScan.h"
+#include "DetoursCpuFeatures.h"
+#include "DetoursTest.h"
+
+#include <vector>
+
+static size_t NaiveFind(const DetoursSignature& signature, const uint8_t* data, size_t size)
+{
+    for (size_t pos = 0; pos + signature.Size() <= size; pos++)
+    {
+        size_t i = 0;
+        while (i < signature.Size() && (data[pos + i] & signature.Mask()[i]) == signature.Bytes()[i])
+            i++;
+        if (i == signature.Size()) return pos;
+    }
+    return size;
+}
+
+int main()
+{
+    // x86 code has a very skewed byte distribution, common opcodes are over represented.
+    const uint8_t        commonBytes[] = {0x8B, 0x44, 0x24, 0x56, 0xE8, 0x00, 0xFF, 0x89, 0x83, 0xC4, 0x5E, 0xC3};
+    std::vector<uint8_t> code(0x80000);
+    DetoursTestRandom    random(3);
+    for (uint8_t& byte : code)
+        byte = random.Below(2) ? commonBytes[random.Below(sizeof(commonBytes))] : uint8_t(random.Next());
+
+    const char* const patterns[] = {
+        "8B 44 24 ?? 56 E8 ?? ?? ?? ?? 83 C4 08 5E C3",
+        "E8 ?? ?? ?? ?? 89 83 12 34 00 00",
+        "?? ?? 8B 44 24 04 8B 4C 24 08 ?? ?? ?? ?? ?? 89 01",
+    };
+    const char* const kernel = DETOURS_X86_SIMD ? (DetoursCpuSupportsAVX2() ? "AVX2" : "SSE2") : "portable";
+    std::printf("Scanning %zu KiB, %s kernel:\n", code.size() / 1024, kernel);
+    for (const char* pattern : patterns)
+    {
+        DetoursSignature signature;
+        DETOURS_CHECK(signature.Parse(pattern));
+        // Placed at the end, as the whole section is scanned to count matches anyway.
+        for (size_t i = 0; i < signature.Size(); i++)
+            code[code.size() - signature.Size() + i] = signature.Bytes()[i];
+        const size_t expected = code.size() - signature.Size();
+
+        const size_t nbScans = 50;
+        const double findNs  = DetoursBenchNanoseconds(nbScans, [&](size_t) {
+            DETOURS_CHECK(signature.Find(code.data(), code.size()) == expected);
+        });
+        const double naiveNs = DetoursBenchNanoseconds(nbScans, [&](size_t) {
+            DETOURS_CHECK(NaiveFind(signature, code.data(), code.size()) == expected);
+        });
+        std::printf("  %s\n    DetoursSignature: %8.1f us (%5.2f GB/s)\n    naive:            %8.1f us\n", pattern,
+                    findNs / 1000, double(code.size()) / findNs, naiveNs / 1000);
+    }
+    return 0;
+}
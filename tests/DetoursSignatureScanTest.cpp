@@ -0,0 +1,116 @@
+// DetoursSignature against a naive search, on random patterns with wildcards. This is built once per kernel: with the
+// default dispatch, with AVX2 disabled, and with the portable code only (see DetoursCpuFeatures.h).
+#include "DetoursSignatureScan.h"
+#include "DetoursTest.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static size_t NaiveFind(const DetoursSignature& signature, const uint8_t* data, size_t size, size_t start)
+{
+    for (size_t pos = start; pos + signature.Size() <= size; pos++)
+    {
+        size_t i = 0;
+        while (i < signature.Size() && (data[pos + i] & signature.Mask()[i]) == signature.Bytes()[i])
+            i++;
+        if (i == signature.Size()) return pos;
+    }
+    return size;
+}
+
+static void CheckParse()
+{
+    DetoursSignature signature;
+    DETOURS_CHECK(signature.Parse("8B 44 24 ?? 56 E8 ? ?? ?? ??"));
+    DETOURS_CHECK(signature.Size() == 10);
+    DETOURS_CHECK(signature.Bytes()[0] == 0x8B && signature.Mask()[0] == 0xFF);
+    DETOURS_CHECK(signature.Bytes()[3] == 0 && signature.Mask()[3] == 0);
+    DETOURS_CHECK(signature.Parse("  ab   Cd "));
+    DETOURS_CHECK(signature.Size() == 2 && signature.Bytes()[0] == 0xAB && signature.Bytes()[1] == 0xCD);
+
+    DetoursSignature other;
+    DETOURS_CHECK(other.Parse("AB CD") && other.Hash() == signature.Hash());
+    DETOURS_CHECK(other.Parse("AB ??") && other.Hash() != signature.Hash());
+    DETOURS_CHECK(other.Parse("AB 00") && other.Hash() != signature.Hash());
+
+    const char* const malformedPatterns[] = {"", "   ", "A", "ABC", "AB CD E", "ABCD", "?A", "G0", "AB,CD", "??? AB"};
+    for (const char* pattern : malformedPatterns)
+        DETOURS_CHECK(!signature.Parse(pattern));
+}
+
+static void CheckEdgeCases()
+{
+    const uint8_t    data[] = {0x10, 0x20, 0x30, 0x40, 0x10, 0x20};
+    DetoursSignature signature;
+    DETOURS_CHECK(signature.Parse("10 20"));
+    DETOURS_CHECK(signature.Find(data, sizeof(data)) == 0);
+    DETOURS_CHECK(signature.Find(data, sizeof(data), 1) == 4);
+    DETOURS_CHECK(signature.Find(data, sizeof(data), 5) == sizeof(data));
+    DETOURS_CHECK(signature.Find(data, sizeof(data), 100) == sizeof(data));
+    DETOURS_CHECK(signature.Find(data, 1) == 1);
+    // Wildcards only match anywhere
+    DETOURS_CHECK(signature.Parse("?? ??"));
+    DETOURS_CHECK(signature.Find(data, sizeof(data), 3) == 3);
+    DETOURS_CHECK(signature.Find(data, sizeof(data), 5) == sizeof(data));
+    DETOURS_CHECK(signature.Parse("40 ?? ?? ??"));
+    DETOURS_CHECK(signature.Find(data, sizeof(data)) == sizeof(data));
+    DETOURS_CHECK(signature.Parse("40 ?? 20"));
+    DETOURS_CHECK(signature.Find(data, sizeof(data)) == 3 && signature.Matches(data + 3) && !signature.Matches(data));
+}
+
+// Random data and patterns over a small alphabet, so that anchors often match without the whole pattern matching.
+static void CheckAgainstNaive(size_t nbIterations)
+{
+    DetoursTestRandom random(10);
+    for (size_t iteration = 0; iteration < nbIterations; iteration++)
+    {
+        const uint32_t       alphabetSize = 2 + random.Below(6);
+        std::vector<uint8_t> data(random.Below(300));
+        for (uint8_t& byte : data)
+            byte = uint8_t(0x90 + random.Below(alphabetSize));
+
+        // Taken from the data half of the time, so that there is at least one match.
+        const uint32_t patternSize   = 1 + random.Below(40);
+        const bool     fromData      = !data.empty() && random.Below(2) == 0;
+        const uint32_t patternOffset = fromData ? random.Below(uint32_t(data.size())) : 0;
+        std::string    pattern;
+        for (uint32_t i = 0; i < patternSize; i++)
+        {
+            if (!pattern.empty()) pattern += ' ';
+            if (random.Below(4) == 0)
+            {
+                pattern += "??";
+                continue;
+            }
+            const uint8_t byte = fromData && patternOffset + i < data.size() ? data[patternOffset + i]
+                                                                             : uint8_t(0x90 + random.Below(alphabetSize));
+            char hex[3];
+            std::snprintf(hex, sizeof(hex), "%02X", byte);
+            pattern += hex;
+        }
+        DetoursSignature signature;
+        DETOURS_CHECK(signature.Parse(pattern.c_str()));
+
+        // Every match, as FindSignature enumerates them
+        size_t expected = NaiveFind(signature, data.data(), data.size(), 0);
+        size_t found    = signature.Find(data.data(), data.size());
+        while (true)
+        {
+            DETOURS_CHECK(found == expected);
+            if (found == data.size()) break;
+            DETOURS_CHECK(signature.Matches(data.data() + found));
+            expected = NaiveFind(signature, data.data(), data.size(), found + 1);
+            found    = signature.Find(data.data(), data.size(), found + 1);
+        }
+    }
+}
+
+int main()
+{
+    CheckParse();
+    CheckEdgeCases();
+    CheckAgainstNaive(200000);
+    std::printf("DetoursSignatureScanTest passed\n");
+    return 0;
+}
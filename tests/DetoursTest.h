@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal test helpers, so that the tests only depend on the standard library.
+
+#define DETOURS_CHECK(condition)                                                                                       \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(condition))                                                                                              \
+        {                                                                                                              \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                         \
+            std::exit(1);                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+/// Keeps the compiler from optimizing away the results of benchmarked code.
+template<class T>
+inline void DetoursDoNotOptimize(const T& value)
+{
+    static volatile uint64_t sink;
+    sink = sink + uint64_t(value);
+}
+
+/// Returns the average time of iteration(index) in nanoseconds, over nbIterations calls.
+template<class Iteration>
+double DetoursBenchNanoseconds(size_t nbIterations, const Iteration& iteration)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t index = 0; index < nbIterations; index++)
+        iteration(index);
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / double(nbIterations);
+}
+
+/// Splitmix64, so that the random inputs are the same on every platform.
+class DetoursTestRandom
+{
+public:
+    explicit DetoursTestRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t Next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z          = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    /// Uniform in [0, bound)
+    uint32_t Below(uint32_t bound) { return uint32_t(Next() % bound); }
+
+private:
+    uint64_t state;
+};
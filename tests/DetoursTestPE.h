@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// A small PE32 dll built in memory, as it would be on disk and once mapped by the loader.
+struct DetoursTestPE
+{
+    // Layout of the image
+    static const uint32_t sizeOfHeaders     = 0x400;
+    static const uint32_t textRva           = 0x1000;
+    static const uint32_t exportRva         = 0x2000;
+    static const uint32_t resourceRva       = 0x3000;
+    static const uint32_t sizeOfImage       = 0x4000;
+    static const uint32_t exportsDirSize    = 0x60;
+    static const uint32_t ordinalBase       = 10000;
+    // Ordinals: 10000 and 10002 share their address, 10003 is forwarded and 10004 is not exported.
+    static const uint32_t nbExportedOrdinals = 5;
+    static const uint32_t sharedFunctionRva  = textRva;
+    static const uint32_t uniqueFunctionRva  = textRva + 0x10;
+
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> image;
+};
+
+/// Builds a dll with a code section, an export directory and a NameOfModulesToPatch resource (type 256) containing
+/// modulesToPatch as UTF-16, as documented for the patch dlls.
+inline DetoursTestPE DetoursBuildTestPE(const std::string& modulesToPatch, uint32_t timeDateStamp = 0x3E9A8C1F)
+{
+    DetoursTestPE pe;
+    struct SectionDesc
+    {
+        const char* name;
+        uint32_t    rva;
+        uint32_t    fileOffset;
+        uint32_t    characteristics;
+    };
+    const SectionDesc sections[] = {
+        {".text", DetoursTestPE::textRva, 0x400, 0x60000020},     // code, executable, readable
+        {".edata", DetoursTestPE::exportRva, 0x600, 0x40000040},  // initialized data, readable
+        {".rsrc", DetoursTestPE::resourceRva, 0x800, 0x40000040}, // initialized data, readable
+    };
+    const uint32_t sectionRawSize = 0x200;
+    const uint32_t fileSize       = 0xA00;
+
+    std::vector<uint8_t>& file = pe.file;
+    file.assign(fileSize, 0);
+    const auto write16 = [&](size_t offset, uint16_t value) { memcpy(&file[offset], &value, sizeof(value)); };
+    const auto write32 = [&](size_t offset, uint32_t value) { memcpy(&file[offset], &value, sizeof(value)); };
+
+    // DOS header
+    write16(0, 0x5A4D);
+    const uint32_t ntOffset = 0x80;
+    write32(0x3C, ntOffset);
+
+    // NT headers
+    write32(ntOffset, 0x00004550);
+    const size_t fileHeader = ntOffset + 4;
+    write16(fileHeader + 0, 0x14C); // i386
+    write16(fileHeader + 2, uint16_t(sizeof(sections) / sizeof(sections[0])));
+    write32(fileHeader + 4, timeDateStamp);
+    write16(fileHeader + 16, 0xE0);   // SizeOfOptionalHeader
+    write16(fileHeader + 18, 0x2102); // Dll, executable, 32 bits
+    const size_t optionalHeader = fileHeader + 20;
+    write16(optionalHeader + 0, 0x10B);
+    write32(optionalHeader + 28, 0x6FA00000); // ImageBase
+    write32(optionalHeader + 32, 0x1000);     // SectionAlignment
+    write32(optionalHeader + 36, 0x200);      // FileAlignment
+    write32(optionalHeader + 56, DetoursTestPE::sizeOfImage);
+    write32(optionalHeader + 60, DetoursTestPE::sizeOfHeaders);
+    write32(optionalHeader + 64, 0x1234ABCD); // CheckSum
+    write16(optionalHeader + 68, 2);          // Windows GUI
+    write32(optionalHeader + 92, 16);         // NumberOfRvaAndSizes
+    const size_t dataDirectories = optionalHeader + 96;
+    write32(dataDirectories + 0 * 8, DetoursTestPE::exportRva);
+    write32(dataDirectories + 0 * 8 + 4, DetoursTestPE::exportsDirSize);
+
+    size_t sectionHeader = optionalHeader + 0xE0;
+    for (const SectionDesc& section : sections)
+    {
+        memcpy(&file[sectionHeader], section.name, strlen(section.name));
+        write32(sectionHeader + 8, sectionRawSize); // VirtualSize
+        write32(sectionHeader + 12, section.rva);
+        write32(sectionHeader + 16, sectionRawSize);
+        write32(sectionHeader + 20, section.fileOffset);
+        write32(sectionHeader + 36, section.characteristics);
+        sectionHeader += 40;
+    }
+
+    // Code: two functions returning 0
+    const uint8_t function[] = {0x33, 0xC0, 0xC3}; // xor eax, eax; ret
+    memcpy(&file[0x400], function, sizeof(function));
+    memcpy(&file[0x410], function, sizeof(function));
+
+    // Exports
+    const size_t   exportDir    = 0x600;
+    const uint32_t functionsRva = DetoursTestPE::exportRva + 0x28;
+    const uint32_t forwarderRva = DetoursTestPE::exportRva + 0x40;
+    const uint32_t dllNameRva   = DetoursTestPE::exportRva + 0x50;
+    write32(exportDir + 12, dllNameRva);
+    write32(exportDir + 16, DetoursTestPE::ordinalBase);
+    write32(exportDir + 20, DetoursTestPE::nbExportedOrdinals);
+    write32(exportDir + 28, functionsRva);
+    const uint32_t functionsRvas[DetoursTestPE::nbExportedOrdinals] = {
+        DetoursTestPE::sharedFunctionRva, DetoursTestPE::uniqueFunctionRva, DetoursTestPE::sharedFunctionRva,
+        forwarderRva, 0};
+    memcpy(&file[exportDir + 0x28], functionsRvas, sizeof(functionsRvas));
+    memcpy(&file[exportDir + 0x40], "D2Common.10001", 15);
+    memcpy(&file[exportDir + 0x50], "Test.dll", 9);
+
+    // Resources: type 256 => name NAMEOFMODULESTOPATCH => language 1033 => data
+    const size_t   resources       = 0x800;
+    const uint32_t highBit         = 0x80000000;
+    const char     resourceName[]  = "NAMEOFMODULESTOPATCH";
+    const uint32_t nameOffset      = 0x58;
+    const uint32_t dataOffset      = 0x90;
+    write16(resources + 14, 1);                     // One id entry
+    write32(resources + 16, 256);
+    write32(resources + 20, highBit | 0x18);
+    write16(resources + 0x18 + 12, 1);              // One named entry
+    write32(resources + 0x18 + 16, highBit | nameOffset);
+    write32(resources + 0x18 + 20, highBit | 0x30);
+    write16(resources + 0x30 + 14, 1);              // One id entry
+    write32(resources + 0x30 + 16, 1033);
+    write32(resources + 0x30 + 20, 0x48);
+    write32(resources + 0x48, DetoursTestPE::resourceRva + dataOffset);
+    write32(resources + 0x48 + 4, uint32_t((modulesToPatch.size() + 1) * 2));
+    write16(resources + nameOffset, uint16_t(strlen(resourceName)));
+    for (size_t i = 0; resourceName[i]; i++)
+        write16(resources + nameOffset + 2 + i * 2, uint16_t(resourceName[i]));
+    for (size_t i = 0; i < modulesToPatch.size() && dataOffset + i * 2 + 2 < sectionRawSize; i++)
+        write16(resources + dataOffset + i * 2, uint16_t(uint8_t(modulesToPatch[i])));
+    write32(dataDirectories + 2 * 8, DetoursTestPE::resourceRva);
+    write32(dataDirectories + 2 * 8 + 4, sectionRawSize);
+
+    // The loader copies the headers and each section at its RVA
+    pe.image.assign(DetoursTestPE::sizeOfImage, 0);
+    memcpy(pe.image.data(), file.data(), DetoursTestPE::sizeOfHeaders);
+    for (const SectionDesc& section : sections)
+        memcpy(&pe.image[section.rva], &file[section.fileOffset], sectionRawSize);
+    return pe;
+}